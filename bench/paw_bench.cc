@@ -0,0 +1,323 @@
+// Microbenchmarks of the ranking pipeline, without nvim or the Lua test
+// runner in the numbers. Build with `make bench`, then
+//
+//   build/paw_bench [items...] [--repeat n]
+//
+// Every corpus is generated from a fixed seed, so runs on the same machine
+// compare change against change.
+extern "C" {
+#include "lauxlib.h"
+#include "lua.h"
+#include "lualib.h"
+}
+
+#include <absl/strings/str_format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "edit_distance.h"
+#include "fzf_score.h"
+#include "paw.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char* const WORDS[] = {
+    "get",    "set",    "is",     "to",     "from",   "make",   "create",
+    "update", "delete", "find",   "parse",  "format", "read",   "write",
+    "string", "buffer", "value",  "index",  "item",   "list",   "map",
+    "vector", "node",   "tree",   "client", "server", "request", "response",
+    "config", "option", "context", "handler", "error", "result", "stream",
+    "file",   "path",   "line",   "column", "range",  "token",  "symbol",
+    "cache",  "size",   "count",  "length", "name",   "type",   "kind",
+};
+constexpr size_t WORD_COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+
+const char* const KEYWORDS[] = {"g", "get", "strbuf", "toStr", "parseReq",
+                                "cfg_opt"};
+
+std::string capitalize(std::string s) {
+  s[0] = toupper(s[0]);
+  return s;
+}
+
+std::string upper(std::string s) {
+  for (char& c : s) {
+    c = toupper(c);
+  }
+  return s;
+}
+
+// identifiers in the shapes servers send: camelCase, snake_case, PascalCase,
+// SCREAMING_CASE and the odd short name
+std::string make_identifier(std::mt19937& rng) {
+  int parts = 1 + rng() % 3;
+  int shape = rng() % 10;
+  std::string s;
+  for (int i = 0; i < parts; ++i) {
+    std::string word = WORDS[rng() % WORD_COUNT];
+    if (shape < 4) {
+      s += i == 0 ? word : capitalize(word);
+    } else if (shape < 7) {
+      s += (i == 0 ? "" : "_") + word;
+    } else if (shape < 9) {
+      s += capitalize(word);
+    } else {
+      s += (i == 0 ? "" : "_") + upper(word);
+    }
+  }
+  if (rng() % 8 == 0) {
+    s += std::to_string(rng() % 100);
+  }
+  return s;
+}
+
+// a cached list as insert_items builds it
+CompletionList make_list(size_t n, uint32_t seed) {
+  std::mt19937 rng(seed);
+  CompletionList list;
+  list.items.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    std::string label = make_identifier(rng);
+    CompletionItem item;
+    item.kind = static_cast<CompletionItemKind>(1 + rng() % 25);
+    if (*item.kind == Method || *item.kind == Function) {
+      item.insert_text = list.strings.add(label + "($1)");
+      item.insert_text_format = 2;
+      label += "(…)";
+    }
+    item.label = list.strings.add(label);
+    item.sort_text = list.strings.add(absl::StrFormat("%04d", rng() % 10000));
+    append_item(list, std::move(item), 1 + i % 2);
+  }
+  list.texts.sort_by_length();
+  return list;
+}
+
+EditDistanceOption make_option(const std::string& keyword) {
+  EditDistanceOption option{};
+  option.keyword = keyword;
+  option.insert_cost = 1;
+  option.delete_cost = 1;
+  option.substitude_cost = 2;
+  option.alpha = 2;
+  option.max_cost = 1.0;
+  option.beta = 2.0;
+  option.gamma = 0.1;
+  option.kernel = AUTO;
+  option.max_results = 100;
+  settle_kernel(option);
+  return option;
+}
+
+// runs fn repeat times and reports the fastest, as ns per unit and units/s
+void report(const char* stage, size_t n, size_t units, int repeat,
+            const std::function<void()>& fn) {
+  double best = 1e300;
+  for (int r = 0; r < repeat; ++r) {
+    auto start = Clock::now();
+    fn();
+    best = std::min(
+        best, std::chrono::duration<double, std::nano>(Clock::now() - start)
+                  .count());
+  }
+  double per_unit = units > 0 ? best / units : 0;
+  absl::PrintF("%-26s %7zu %12.3f ms %10.1f ns %14.0f /s\n", stage, n,
+               best / 1e6, per_unit, per_unit > 0 ? 1e9 / per_unit : 0);
+}
+
+// keeps the optimizer from dropping a result
+volatile double sink;
+
+void bench_scoring(size_t n, int repeat) {
+  CompletionList list = make_list(n, n);
+  std::vector<uint32_t> all(list.items.size());
+  for (size_t i = 0; i < all.size(); ++i) {
+    all[i] = i;
+  }
+  const size_t keywords = sizeof(KEYWORDS) / sizeof(KEYWORDS[0]);
+  const size_t units = all.size() * keywords;
+
+  report("edit_distance dp", n, units, repeat, [&] {
+    long total = 0;
+    for (const char* keyword : KEYWORDS) {
+      EditDistanceOption option = make_option(keyword);
+      for (uint32_t i : all) {
+        total += edit_distance(get_text(list, list.items[i]), option);
+      }
+    }
+    sink = total;
+  });
+
+  report("edit_distance bitparallel", n, units, repeat, [&] {
+    long total = 0;
+    for (const char* keyword : KEYWORDS) {
+      BitParallelPattern pattern(keyword, 1, 1, 2, 2);
+      for (uint32_t i : all) {
+        total += pattern.distance(get_text(list, list.items[i]));
+      }
+    }
+    sink = total;
+  });
+
+  std::vector<int> distances(list.texts.size());
+  // what the "dp" kernel runs
+  report("edit_distance scalar", n, units, repeat, [&] {
+    for (const char* keyword : KEYWORDS) {
+      batch_edit_distance(list.texts, list.texts.by_length, keyword, 1, 1, 2,
+                          2, distances, SCALAR);
+    }
+    sink = distances[0];
+  });
+
+  report("edit_distance simd", n, units, repeat, [&] {
+    for (const char* keyword : KEYWORDS) {
+      batch_edit_distance(list.texts, list.texts.by_length, keyword, 1, 1, 2,
+                          2, distances);
+    }
+    sink = distances[0];
+  });
+
+  std::vector<int> scores(list.texts.size());
+  report("fzf scalar", n, units, repeat, [&] {
+    for (const char* keyword : KEYWORDS) {
+      batch_fzf_score(list.texts, list.texts.by_length.data(),
+                      list.texts.size(), to_lower(keyword), scores.data(),
+                      SCALAR);
+    }
+    sink = scores[0];
+  });
+
+  report("fzf simd", n, units, repeat, [&] {
+    for (const char* keyword : KEYWORDS) {
+      batch_fzf_score(list.texts, list.texts.by_length.data(),
+                      list.texts.size(), to_lower(keyword), scores.data());
+    }
+    sink = scores[0];
+  });
+
+  report("compute_cost", n, units, repeat, [&] {
+    double total = 0;
+    for (const char* keyword : KEYWORDS) {
+      EditDistanceOption option = make_option(keyword);
+      for (uint32_t i : all) {
+        total += compute_cost(get_text(list, list.items[i]), distances[i],
+                              keyword, option);
+      }
+    }
+    sink = total;
+  });
+
+  // costs with ties, as the normalized costs of one ranking have
+  std::mt19937 rng(n);
+  for (CompletionItem& item : list.items) {
+    item.cost = (rng() % 500) / 100.0;
+  }
+  std::vector<uint32_t> order;
+  report("sort CompareCompletion", n, all.size(), repeat, [&] {
+    order = all;
+    std::sort(order.begin(), order.end(), CompareCompletionItem{list});
+  });
+  report("top 100 CompareCompletion", n, all.size(), repeat, [&] {
+    order = all;
+    size_t k = std::min<size_t>(100, order.size());
+    std::partial_sort(order.begin(), order.begin() + k, order.end(),
+                      CompareCompletionItem{list});
+  });
+
+  report("rank_list", n, keywords, repeat, [&] {
+    for (const char* keyword : KEYWORDS) {
+      EditDistanceOption option = make_option(keyword);
+      // every keyword starts over instead of narrowing the last one
+      list.refinable = false;
+      rank_list(list, option, keyword, nullptr);
+    }
+  });
+
+  report("rank_list fzf", n, keywords, repeat, [&] {
+    for (const char* keyword : KEYWORDS) {
+      EditDistanceOption option = make_option(keyword);
+      option.scorer = FZF;
+      list.refinable = false;
+      rank_list(list, option, keyword, nullptr);
+    }
+  });
+}
+
+void bench_lfu(size_t n, int repeat) {
+  constexpr int SIZE = 4096;
+  LFU<CacheKey, CompletionList, HashCacheKey, SIZE> cache;
+  std::mt19937 rng(n);
+  std::vector<CacheKey> keys(n);
+  for (CacheKey& key : keys) {
+    key = CacheKey{static_cast<int>(rng() % 16),
+                   static_cast<int>(rng() % 2000), static_cast<int>(rng() % 80)};
+  }
+  report("lfu put", n, n, repeat, [&] {
+    cache.clear();
+    for (const CacheKey& key : keys) {
+      cache.put(key, CompletionList{});
+    }
+  });
+  report("lfu get", n, n, repeat, [&] {
+    size_t total = 0;
+    for (const CacheKey& key : keys) {
+      total += cache.get(key).items.size();
+    }
+    sink = total;
+  });
+}
+
+void bench_push(size_t n, int repeat) {
+  CompletionList list = make_list(n, n);
+  InternPool interned;
+  WordRange word{1, 1, 4};
+  lua_State* L = luaL_newstate();
+  report("push_completion_item", n, n, repeat, [&] {
+    lua_createtable(L, n, 0);
+    for (size_t i = 0; i < list.items.size(); ++i) {
+      push_completion_item(L, list, list.items[i], interned, word);
+      lua_rawseti(L, -2, i + 1);
+    }
+    lua_pop(L, 1);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+  });
+  lua_close(L);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<size_t> sizes;
+  int repeat = 5;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = std::max(1, atoi(argv[++i]));
+    } else {
+      sizes.push_back(strtoul(argv[i], nullptr, 10));
+    }
+  }
+  if (sizes.empty()) {
+    sizes = {1000, 10000, 100000};
+  }
+
+  absl::PrintF("simd level %d, best of %d, %zu keywords per scoring pass\n",
+               detect_simd_level(), repeat,
+               sizeof(KEYWORDS) / sizeof(KEYWORDS[0]));
+  absl::PrintF("%-26s %7s %15s %13s %16s\n", "stage", "items", "time",
+               "per unit", "throughput");
+  for (size_t n : sizes) {
+    bench_scoring(n, repeat);
+    bench_lfu(n, repeat);
+    bench_push(n, repeat);
+  }
+  return 0;
+}
@@ -0,0 +1,307 @@
+// Replays a session recorded with paw.start_recording through the paw module
+// the way the editor calls it, without the editor, and reports the latency
+// and the allocations of every call. Run it with
+// `make replay SESSION=session.bin`, or once built
+//
+//   build/paw_replay session.bin [--calls]
+//
+// --calls prints every call instead of only the summary per kind of call.
+extern "C" {
+#include "lauxlib.h"
+#include "lua.h"
+}
+
+#include <absl/strings/str_format.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "histogram.h"
+#include "session_log.h"
+
+extern "C" int luaopen_paw(lua_State* L);
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// operator new calls, libpaw's included
+std::atomic<uint64_t> cpp_allocations{0};
+uint64_t lua_allocations = 0;
+
+void* count_lua_alloc(void* counter, void* ptr, size_t, size_t size) {
+  if (size == 0) {
+    free(ptr);
+    return nullptr;
+  }
+  ++*static_cast<uint64_t*>(counter);
+  return realloc(ptr, size);
+}
+
+void set_int(lua_State* L, const char* key, lua_Integer value) {
+  lua_pushinteger(L, value);
+  lua_setfield(L, -2, key);
+}
+
+void set_number(lua_State* L, const char* key, double value) {
+  lua_pushnumber(L, value);
+  lua_setfield(L, -2, key);
+}
+
+void set_string(lua_State* L, const char* key, std::string_view value) {
+  lua_pushlstring(L, value.data(), value.size());
+  lua_setfield(L, -2, key);
+}
+
+void push_range(lua_State* L, const int* coords) {
+  lua_createtable(L, 0, 2);
+  lua_createtable(L, 0, 2);
+  set_int(L, "line", coords[0]);
+  set_int(L, "character", coords[1]);
+  lua_setfield(L, -2, "start");
+  lua_createtable(L, 0, 2);
+  set_int(L, "line", coords[2]);
+  set_int(L, "character", coords[3]);
+  lua_setfield(L, -2, "end");
+}
+
+// the items as the lsp client hands them to insert_items
+void push_items(lua_State* L, const SessionInsert& insert) {
+  lua_createtable(L, insert.items.size(), 0);
+  int index = 1;
+  for (const SessionItem& item : insert.items) {
+    lua_createtable(L, 0, 8);
+    set_string(L, "label", item.label);
+    if (item.filter_text) {
+      set_string(L, "filterText", *item.filter_text);
+    }
+    if (item.sort_text) {
+      set_string(L, "sortText", *item.sort_text);
+    }
+    if (item.insert_text) {
+      set_string(L, "insertText", *item.insert_text);
+    }
+    if (item.detail) {
+      set_string(L, "detail", *item.detail);
+    }
+    if (item.kind) {
+      set_int(L, "kind", *item.kind);
+    }
+    if (item.insert_text_format) {
+      set_int(L, "insertTextFormat", *item.insert_text_format);
+    }
+    if (item.text_edit) {
+      const SessionEdit& edit = *item.text_edit;
+      lua_createtable(L, 0, 2);
+      set_string(L, "newText", edit.new_text);
+      const char* const names[] = {"range", "insert", "replace"};
+      for (int r = 0; r < 3; ++r) {
+        if (edit.ranges & (1 << r)) {
+          push_range(L, edit.coords[r]);
+          lua_setfield(L, -2, names[r]);
+        }
+      }
+      lua_setfield(L, -2, "textEdit");
+    }
+    lua_rawseti(L, -2, index++);
+  }
+}
+
+void push_option(lua_State* L, const SessionQuery& query) {
+  const char* const kernels[] = {"auto", "dp", "bit_parallel", "simd"};
+  const char* const scorers[] = {"levenshtein", "fzf"};
+  lua_createtable(L, 0, 15);
+  set_string(L, "keyword", query.keyword);
+  set_string(L, "scorer", scorers[query.scorer < 2 ? query.scorer : 0]);
+  set_int(L, "insert_cost", query.insert_cost);
+  set_int(L, "delete_cost", query.delete_cost);
+  set_int(L, "substitude_cost", query.substitude_cost);
+  set_int(L, "alpha", query.alpha);
+  set_number(L, "max_cost", query.max_cost);
+  set_number(L, "beta", query.beta);
+  set_number(L, "gamma", query.gamma);
+  set_string(L, "kernel", kernels[query.kernel < 4 ? query.kernel : 0]);
+  set_int(L, "max_results", query.max_results);
+  lua_pushboolean(L, query.lazy);
+  lua_setfield(L, -2, "lazy");
+  set_int(L, "index_threshold", query.index_threshold);
+  set_string(L, "filetype", query.filetype);
+  set_number(L, "frecency_boost", query.frecency_boost);
+}
+
+struct CallStats {
+  const char* name;
+  Histogram latency;
+  Histogram cpp;
+  Histogram lua;
+};
+
+void print_summary(const CallStats& stats) {
+  if (stats.latency.count() == 0) {
+    return;
+  }
+  auto us = [](uint64_t ns) { return ns / 1e3; };
+  absl::PrintF(
+      "%-22s %7u %10.1f %10.1f %10.1f %10.1f %12.1f %12.1f\n", stats.name,
+      stats.latency.count(), us(stats.latency.percentile(0.5)),
+      us(stats.latency.percentile(0.9)), us(stats.latency.percentile(0.99)),
+      us(stats.latency.max()), stats.cpp.mean(), stats.lua.mean());
+}
+
+// prints a stage table of paw.stats(), the module is at index module
+void print_stages(lua_State* L, int module) {
+  lua_getfield(L, module, "stats");
+  lua_call(L, 0, 1);
+  absl::PrintF("\n%-22s %7s %10s %10s %10s %10s\n", "stage (us, items)",
+               "count", "p50", "p90", "p99", "max");
+  for (const char* stage : {"parse", "score", "normalize", "sort", "marshal",
+                            "inserted", "ranked", "matched"}) {
+    lua_getfield(L, -1, stage);
+    double values[5];
+    const char* const fields[] = {"count", "p50", "p90", "p99", "max"};
+    for (int i = 0; i < 5; ++i) {
+      lua_getfield(L, -1, fields[i]);
+      values[i] = lua_tonumber(L, -1);
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    absl::PrintF("%-22s %7.0f %10.1f %10.1f %10.1f %10.1f\n", stage,
+                 values[0], values[1], values[2], values[3], values[4]);
+  }
+  lua_pop(L, 1);
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  cpp_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+int main(int argc, char** argv) {
+  const char* path = nullptr;
+  bool calls = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--calls") == 0) {
+      calls = true;
+    } else {
+      path = argv[i];
+    }
+  }
+  if (!path) {
+    absl::FPrintF(stderr, "usage: %s session.bin [--calls]\n", argv[0]);
+    return 2;
+  }
+  SessionReader reader;
+  if (!reader.open(path)) {
+    absl::FPrintF(stderr, "%s is not a session file\n", path);
+    return 1;
+  }
+
+  lua_State* L = lua_newstate(count_lua_alloc, &lua_allocations);
+  luaopen_paw(L);
+  const int module = lua_gettop(L);
+
+  CallStats inserts{"insert_items", {}, {}, {}};
+  CallStats queries{"get_completion_items", {}, {}, {}};
+  CallStats clears{"clear_completion_items", {}, {}, {}};
+  if (calls) {
+    absl::PrintF("%6s %-22s %6s %8s %10s %10s %10s\n", "call", "kind",
+                 "bufnr", "items", "us", "new", "lua alloc");
+  }
+
+  SessionOp op;
+  SessionInsert insert;
+  SessionQuery query;
+  size_t index = 0;
+  while (reader.next(op, insert, query)) {
+    CallStats* stats = nullptr;
+    int nargs = 0;
+    int bufnr = 0;
+    size_t items = 0;
+    switch (op) {
+      case SessionOp::INSERT:
+        stats = &inserts;
+        lua_getfield(L, module, "insert_items");
+        push_items(L, insert);
+        lua_pushinteger(L, insert.client_id);
+        lua_pushinteger(L, insert.bufnr);
+        lua_pushinteger(L, insert.line);
+        lua_pushinteger(L, insert.col);
+        nargs = 5;
+        bufnr = insert.bufnr;
+        items = insert.items.size();
+        break;
+      case SessionOp::QUERY:
+        stats = &queries;
+        lua_getfield(L, module, "get_completion_items");
+        lua_pushinteger(L, query.bufnr);
+        lua_pushinteger(L, query.line);
+        lua_pushinteger(L, query.col);
+        lua_pushinteger(L, query.start);
+        push_option(L, query);
+        lua_pushinteger(L, query.cursor);
+        nargs = 6;
+        bufnr = query.bufnr;
+        break;
+      case SessionOp::CLEAR:
+        stats = &clears;
+        lua_getfield(L, module, "clear_completion_items");
+        break;
+    }
+
+    uint64_t cpp_before = cpp_allocations.load();
+    uint64_t lua_before = lua_allocations;
+    Clock::time_point start = Clock::now();
+    if (lua_pcall(L, nargs, 1, 0) != 0) {
+      absl::FPrintF(stderr, "call %zu failed: %s\n", index,
+                    lua_tostring(L, -1));
+      return 1;
+    }
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start)
+                      .count();
+    uint64_t cpp = cpp_allocations.load() - cpp_before;
+    uint64_t lua = lua_allocations - lua_before;
+    // lazy results are userdata, their length is not counted
+    if (op == SessionOp::QUERY && lua_istable(L, -1)) {
+      items = lua_objlen(L, -1);
+    }
+    lua_settop(L, module);
+
+    stats->latency.record(ns);
+    stats->cpp.record(cpp);
+    stats->lua.record(lua);
+    if (calls) {
+      absl::PrintF("%6zu %-22s %6d %8zu %10.1f %10u %10u\n", index,
+                   stats->name, bufnr, items, ns / 1e3, cpp, lua);
+    }
+    index++;
+  }
+  if (reader.error()) {
+    absl::FPrintF(stderr, "%s is cut short after call %zu\n", path, index);
+  }
+
+  absl::PrintF("\n%-22s %7s %10s %10s %10s %10s %12s %12s\n", "call (us)",
+               "count", "p50", "p90", "p99", "max", "new/call",
+               "lua alloc/call");
+  print_summary(inserts);
+  print_summary(queries);
+  print_summary(clears);
+  print_stages(L, module);
+  lua_close(L);
+  return reader.error() ? 1 : 0;
+}
@@ -14,6 +14,12 @@ popup_menu.setup()
 local context = {
   request_ids = {},
   preview_id = nil,
+  -- bumped by every trigger so chunks of an older response stop inserting
+  insert_generation = 0,
+  -- buffers whose lines feed paw.set_buffer_lines
+  buffer_words = {},
+  -- filetype to its option, with the profile paw.create_profile compiled
+  options = {},
   ns_id = api.nvim_create_namespace("pawtocomplete.completion"),
 }
 
@@ -105,35 +111,96 @@ local function apply_text_edit(item)
   end
 end
 
-M.show_completion = function(start)
-  local base_word = find_completion_base_word(start + 1)
-  if not base_word then
-    base_word = ''
-  end
-  local pos = api.nvim_win_get_cursor(0)
-
-  local option = {
-    keyword = base_word,
-    insert_cost = config.completion.insert_cost,
-    delete_cost = config.completion.delete_cost,
-    substitude_cost = config.completion.substitude_cost,
-    max_cost = config.completion.max_cost,
-  }
-  local bufnr = api.nvim_get_current_buf()
-  local items = paw.get_completion_items(bufnr, pos[1], pos[2], start + 1, option)
+local function open_menu(items, option)
   if fn.mode() == 'i' and #items > 0 then
     paw.interact()
     popup_menu.open(items, {
       on_select = function(selected_item, _)
+        if option.frecency_boost > 0 and selected_item.label then
+          paw.record_selection(option.filetype, selected_item.label)
+        end
         apply_text_edit(selected_item)
       end,
       on_preview = function(item, _)
         extmark_at_cursor(item)
-      end
+      end,
+      fetch_more = function(offset)
+        if (option.max_results or 0) > 0 then
+          return paw.get_completion_page(offset, option.max_results)
+        end
+        return {}
+      end,
     })
   end
 end
 
+-- opens the menu once the pending rank_async request is ranked
+local function start_rank_poll()
+  if context.rank_poll then
+    return
+  end
+  context.rank_poll = vim.uv.new_poll(paw.async_fd())
+  context.rank_poll:start('r', function()
+    local pending = context.rank_request
+    -- take_result also clears the wakeup, so call it even with nothing pending
+    local items = paw.take_result(pending and pending.id or 0)
+    if items then
+      context.rank_request = nil
+      vim.schedule(function()
+        open_menu(items, pending.option)
+      end)
+    end
+  end)
+end
+
+-- the option of a filetype, built once so a keystroke only passes the keyword
+local function get_option(filetype)
+  local option = context.options[filetype]
+  if option then
+    return option
+  end
+  option = {
+    insert_cost = config.completion.insert_cost,
+    delete_cost = config.completion.delete_cost,
+    substitude_cost = config.completion.substitude_cost,
+    max_cost = config.completion.max_cost,
+    kernel = config.completion.kernel,
+    scorer = (config.completion.filetype_scorer or {})[filetype] or config.completion.scorer,
+    max_results = config.completion.max_results,
+    lazy = config.completion.lazy_items,
+    index_threshold = config.completion.index_threshold,
+    filetype = filetype,
+    frecency_boost = config.completion.frecency_boost or 0,
+  }
+  if option.lazy then
+    -- a lazy result cannot be appended to, so it holds every match
+    option.max_results = 0
+  end
+  option.profile = paw.create_profile(option)
+  context.options[filetype] = option
+  return option
+end
+
+-- cached_col is the col a reusable response for this word was cached at
+M.show_completion = function(start, cached_col)
+  local base_word = find_completion_base_word(start + 1)
+  if not base_word then
+    base_word = ''
+  end
+  local pos = api.nvim_win_get_cursor(0)
+
+  local option = get_option(vim.bo.filetype)
+  local bufnr = api.nvim_get_current_buf()
+  if config.completion.async_ranking then
+    start_rank_poll()
+    local id = paw.rank_async(bufnr, pos[1], cached_col or pos[2], start + 1, option.profile, pos[2], base_word)
+    context.rank_request = { id = id, option = option }
+    return
+  end
+  local items = paw.get_completion_items(bufnr, pos[1], cached_col or pos[2], start + 1, option.profile, pos[2], base_word)
+  open_menu(items, option)
+end
+
 local function lsp_completion_request(client, bufnr, callback)
   if context.request_ids[client.id] then
     client.cancel_request(context.request_ids[client.id])
@@ -145,8 +212,9 @@ local function lsp_completion_request(client, bufnr, callback)
   local handler = function(err, client_result, _)
     if not err then
       local items = paw.table_get(client_result, { 'items' }) or client_result
+      local is_incomplete = paw.table_get(client_result, { 'isIncomplete' }) == true
       if items then
-        callback(items)
+        callback(items, is_incomplete)
       end
     end
   end
@@ -174,13 +242,82 @@ local function can_trigger_completion(bufnr)
   end
 
   local clients = vim.lsp.get_clients({ bufnr = bufnr })
-  if #clients == 0 then
+  if #clients == 0 and not config.completion.buffer_words then
     return false
   end
   return true
 end
 
-M.trigger_completion = util.debounce(function(bufnr)
+-- keeps the native word index of bufnr current, only changed lines are sent
+local function attach_buffer_words(bufnr)
+  if context.buffer_words[bufnr] or not api.nvim_buf_is_loaded(bufnr) then
+    return
+  end
+  context.buffer_words[bufnr] = true
+  paw.set_buffer_lines(bufnr, 0, -1, api.nvim_buf_get_lines(bufnr, 0, -1, false))
+  api.nvim_buf_attach(bufnr, false, {
+    on_lines = function(_, buf, _, first, last, new_last)
+      paw.set_buffer_lines(buf, first, last, api.nvim_buf_get_lines(buf, first, new_last, false))
+    end,
+    on_reload = function(_, buf)
+      paw.clear_buffer_words(buf)
+      paw.set_buffer_lines(buf, 0, -1, api.nvim_buf_get_lines(buf, 0, -1, false))
+    end,
+    on_detach = function(_, buf)
+      context.buffer_words[buf] = nil
+      paw.clear_buffer_words(buf)
+    end,
+  })
+end
+
+-- the col every completion client cached its complete response for word at,
+-- nil when some client has to be asked again
+local function find_refilter_col(clients, bufnr, line, start, word)
+  local cached_col = nil
+  for _, client in pairs(clients) do
+    if paw.table_get(client, { 'server_capabilities', 'completionProvider' }) then
+      local col = paw.can_refilter(client.id, bufnr, line, start + 1, word)
+      if col == nil or (cached_col ~= nil and col ~= cached_col) then
+        return nil
+      end
+      cached_col = col
+    end
+  end
+  return cached_col
+end
+
+-- inserts a response a chunk per tick so no single call blocks typing, the
+-- menu opens on the first chunk and is refreshed once the last one is in
+local function insert_response(items, client_id, bufnr, line, col, response, on_chunk)
+  local chunk_us = config.completion.insert_chunk_us
+  if not chunk_us or chunk_us <= 0 then
+    paw.insert_items(items, client_id, bufnr, line, col, response)
+    on_chunk()
+    return
+  end
+
+  local generation = context.insert_generation
+  local function insert_from(offset)
+    if generation ~= context.insert_generation then
+      return
+    end
+    local next_offset = paw.insert_items(items, client_id, bufnr, line, col, response, {
+      offset = offset,
+      max_us = chunk_us,
+    })
+    if offset == 1 or next_offset == nil then
+      on_chunk()
+    end
+    if next_offset ~= nil then
+      vim.schedule(function()
+        insert_from(next_offset)
+      end)
+    end
+  end
+  insert_from(1)
+end
+
+local function trigger_completion(bufnr)
   if not can_trigger_completion(bufnr) then
     return
   end
@@ -206,21 +343,58 @@ M.trigger_completion = util.debounce(function(bufnr)
   end
 
   popup_menu.close()
-  -- if paw.has_cache(bufnr, line, col) then
-  --   M.show_completion(start)
-  -- end
+  context.insert_generation = context.insert_generation + 1
+  if start < 0 or start > col then
+    paw.clear_completion_items()
+    return
+  end
+
+  local word = line_to_cursor:sub(start + 1)
+  local cached_col = find_refilter_col(clients, bufnr, line, start, word)
+  if cached_col then
+    M.show_completion(start, cached_col)
+    return
+  end
   paw.clear_completion_items()
 
-  if start >= 0 and start <= col then
-    for _, client in pairs(clients) do
-      if paw.table_get(client, { 'server_capabilities', 'completionProvider' }) then
-        lsp_completion_request(client, bufnr, function(items)
-          paw.insert_items(items, client.id, bufnr, line, col)
+  -- shown right away, the responses of the servers join them as they come
+  if #word > 0 then
+    local shown = 0
+    if config.completion.buffer_words then
+      shown = shown + paw.insert_buffer_words(bufnr, line, col, word)
+    end
+    if config.completion.persistent_cache then
+      shown = shown + paw.insert_saved_items(bufnr, api.nvim_buf_get_name(bufnr), line, col, word)
+    end
+    if shown > 0 then
+      M.show_completion(start)
+    end
+  end
+
+  for _, client in pairs(clients) do
+    if paw.table_get(client, { 'server_capabilities', 'completionProvider' }) then
+      paw.set_client_priority(client.id, config.completion.client_priority[client.name] or 0)
+      lsp_completion_request(client, bufnr, function(items, is_incomplete)
+        local response = {
+          word_start = start + 1,
+          word = word,
+          is_incomplete = is_incomplete,
+          -- text edit ranges count in the client's encoding, paw turns them into bytes
+          line_text = current_line,
+          encoding = client.offset_encoding or 'utf-16',
+        }
+        insert_response(items, client.id, bufnr, line, col, response, function()
           M.show_completion(start)
         end)
-      end
+      end)
     end
   end
+end
+
+M.trigger_completion = util.debounce(function(bufnr)
+  local trace_start = paw.trace_now()
+  trigger_completion(bufnr)
+  paw.trace_span('trigger_completion', trace_start, bufnr)
 end, config.completion.delay)
 
 M.stop_completion = function()
@@ -239,11 +413,70 @@ M.auto_complete = function()
   M.trigger_completion(bufnr)
 end
 
+local function persistent_cache_path()
+  local path = config.completion.persistent_cache_path
+  if not path then
+    local dir = vim.fn.stdpath('cache') .. '/pawtocomplete'
+    vim.fn.mkdir(dir, 'p')
+    path = dir .. '/responses.bin'
+  end
+  return path
+end
+
+-- keyed by file path, a buffer number means nothing next session
+local function save_persistent_cache()
+  local buffers = {}
+  for _, bufnr in ipairs(api.nvim_list_bufs()) do
+    local name = api.nvim_buf_get_name(bufnr)
+    if name ~= '' then
+      buffers[bufnr] = name
+    end
+  end
+  paw.save_response_cache(persistent_cache_path(), buffers)
+end
+
 M.setup = function()
+  if config.completion.cache_budget_mb then
+    paw.set_cache_budget(config.completion.cache_budget_mb * 1024 * 1024)
+  end
+  if config.completion.worker_threads then
+    paw.set_worker_threads(config.completion.worker_threads)
+  end
+  if config.completion.trace then
+    paw.set_trace(true)
+  end
+  if (config.completion.frecency_boost or 0) > 0 then
+    local path = config.completion.frecency_path
+    if not path then
+      local dir = vim.fn.stdpath('data') .. '/pawtocomplete'
+      vim.fn.mkdir(dir, 'p')
+      path = dir .. '/frecency.bin'
+    end
+    local ok, err = paw.open_frecency(path, config.completion.frecency_half_life_days * 24)
+    if not ok then
+      vim.notify('pawtocomplete: cannot open ' .. path .. ': ' .. err, vim.log.levels.WARN)
+    end
+  end
+
+  if config.completion.persistent_cache then
+    paw.load_response_cache(persistent_cache_path())
+    api.nvim_create_autocmd({ 'VimLeavePre' }, {
+      callback = save_persistent_cache
+    })
+  end
+
   api.nvim_create_autocmd({ 'InsertCharPre' }, {
     callback = M.auto_complete
   })
 
+  if config.completion.buffer_words then
+    api.nvim_create_autocmd({ 'BufEnter', 'InsertEnter' }, {
+      callback = function(args)
+        attach_buffer_words(args.buf)
+      end
+    })
+  end
+
   api.nvim_create_autocmd({ 'InsertLeavePre' }, {
     callback = function()
       M.stop_completion()
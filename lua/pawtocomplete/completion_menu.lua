@@ -41,6 +41,7 @@ local context = {
   selected_idx = 1,
   on_select = nil,
   on_preview = nil,
+  fetch_more = nil,
 }
 
 
@@ -198,7 +199,10 @@ local function render_menu()
 
   local config = context.config
   local content_width = 0
-  for i, item in ipairs(context.items) do
+  local trace_start = paw.trace_now()
+  -- items may be a lazy paw result, which ipairs cannot walk
+  for i = 1, #context.items do
+    local item = context.items[i]
     local kind = lsp.protocol.CompletionItemKind[item.kind]
     local label = item.label or ''
     local symbol = SYMBOLS[kind] or ''
@@ -233,6 +237,8 @@ local function render_menu()
     })
   end
 
+  paw.trace_span('format_completion_item', trace_start, nil, nil, #context.items)
+
   api.nvim_win_set_width(context.win, content_width - 2)
   api.nvim_buf_set_lines(context.buf, 0, -1, false, lines)
   api.nvim_buf_clear_namespace(context.buf, context.ns_id, 0, -1)
@@ -258,6 +264,12 @@ local function render_menu()
 end
 
 local function select_item(idx)
+  if idx > #context.items and context.fetch_more then
+    for _, item in ipairs(context.fetch_more(#context.items)) do
+      table.insert(context.items, item)
+    end
+  end
+
   if idx < 1 then
     idx = #context.items
   elseif idx > #context.items then
@@ -410,6 +422,7 @@ function M.open(items, opt)
   context.items = items
   context.on_select = opt.on_select
   context.on_preview = opt.on_preview
+  context.fetch_more = opt.fetch_more
   context.config = config
   context.selected_idx = 1
   while context.items[context.selected_idx] and (context.items[context.selected_idx].type == 'separator' or context.items[context.selected_idx].type == 'title') do
@@ -10,6 +10,44 @@ local config = {
     insert_cost = 1,
     delete_cost = 1,
     substitude_cost = 2,
+    -- 'dp', 'bit_parallel', 'simd' or 'auto'
+    kernel = 'auto',
+    -- 'levenshtein' or 'fzf', which favours word starts and camelCase humps
+    scorer = 'levenshtein',
+    -- filetype to scorer, unlisted filetypes use scorer
+    filetype_scorer = {},
+    -- items ranked per keystroke, the menu pages in the rest. 0 ranks all
+    max_results = 100,
+    -- return items as userdata that builds fields on access, ranks all
+    lazy_items = false,
+    -- responses this large are filtered through an index, 0 always scans
+    index_threshold = 20000,
+    -- memory kept for cached responses before the least used are evicted
+    cache_budget_mb = 256,
+    -- threads scoring large responses, 0 uses every core
+    worker_threads = 0,
+    -- rank on a background thread so typing never waits for it
+    async_ranking = false,
+    -- microseconds a response is parsed for per tick, 0 inserts it at once
+    insert_chunk_us = 2000,
+    -- client name to priority, of duplicate items across clients the one
+    -- from the higher priority client is kept, unlisted clients are 0
+    client_priority = {},
+    -- also complete words of the buffer, with or without a language server
+    buffer_words = true,
+    -- rank accepted completions higher, 0 turns it off
+    frecency_boost = 0.2,
+    -- days after which an accept counts half
+    frecency_half_life_days = 14,
+    -- where accepts are kept, defaults to the data directory
+    frecency_path = nil,
+    -- serve last session's items until the server answers, saved on exit
+    persistent_cache = false,
+    -- where they are saved, defaults to the cache directory
+    persistent_cache_path = nil,
+    -- keep timed spans of the last keystrokes for paw.trace_dump(path),
+    -- paw.set_trace() toggles it while running
+    trace = false,
   },
   signature = {
     max_width = 120,
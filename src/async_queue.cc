@@ -0,0 +1,91 @@
+#include "async_queue.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace {
+
+bool set_flags(int fd) {
+  return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0 &&
+         fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+}  // namespace
+
+AsyncQueue::AsyncQueue() {
+  if (pipe(fds_) != 0) {
+    fds_[0] = fds_[1] = -1;
+    return;
+  }
+  if (!set_flags(fds_[0]) || !set_flags(fds_[1])) {
+    close(fds_[0]);
+    close(fds_[1]);
+    fds_[0] = fds_[1] = -1;
+    return;
+  }
+  thread_ = std::thread(&AsyncQueue::run, this);
+}
+
+AsyncQueue::~AsyncQueue() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  ready_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  if (ok()) {
+    close(fds_[0]);
+    close(fds_[1]);
+  }
+}
+
+uint64_t AsyncQueue::submit(int slot, std::function<void(uint64_t)> job) {
+  uint64_t id;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    id = ++next_id_;
+    latest_[slot] = id;
+    jobs_.erase(std::remove_if(jobs_.begin(), jobs_.end(),
+                               [slot](const Job& j) { return j.slot == slot; }),
+                jobs_.end());
+    jobs_.push_back(Job{id, slot, std::move(job)});
+  }
+  ready_.notify_one();
+  return id;
+}
+
+bool AsyncQueue::superseded(int slot, uint64_t id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = latest_.find(slot);
+  return it != latest_.end() && it->second != id;
+}
+
+void AsyncQueue::drain() {
+  char buffer[64];
+  while (read(fds_[0], buffer, sizeof(buffer)) > 0) {
+  }
+}
+
+void AsyncQueue::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    ready_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+    if (stop_) {
+      return;
+    }
+    Job job = std::move(jobs_.front());
+    jobs_.pop_front();
+    lock.unlock();
+
+    job.fn(job.id);
+    // a full pipe already has a wakeup pending
+    char c = 0;
+    [[maybe_unused]] ssize_t n = write(fds_[1], &c, 1);
+
+    lock.lock();
+  }
+}
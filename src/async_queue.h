@@ -0,0 +1,58 @@
+#ifndef ASYNC_QUEUE_H
+#define ASYNC_QUEUE_H
+
+#include <absl/container/flat_hash_map.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Runs jobs one at a time on a background thread and wakes the editor
+// through a pipe it can poll. A job submitted for a slot drops the one still
+// queued for that slot, and superseded() tells a running job that a newer one
+// was submitted after it.
+class AsyncQueue {
+ public:
+  AsyncQueue();
+  ~AsyncQueue();
+
+  AsyncQueue(const AsyncQueue&) = delete;
+  AsyncQueue& operator=(const AsyncQueue&) = delete;
+
+  // false when the pipe could not be created, nothing runs then
+  bool ok() const { return fds_[0] >= 0; }
+
+  // readable once a job finished, until drain()
+  int fd() const { return fds_[0]; }
+
+  // returns the id the job is called with
+  uint64_t submit(int slot, std::function<void(uint64_t)> job);
+
+  bool superseded(int slot, uint64_t id);
+
+  void drain();
+
+ private:
+  struct Job {
+    uint64_t id;
+    int slot;
+    std::function<void(uint64_t)> fn;
+  };
+
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<Job> jobs_;
+  // newest id submitted per slot
+  absl::flat_hash_map<int, uint64_t> latest_;
+  uint64_t next_id_ = 0;
+  bool stop_ = false;
+  int fds_[2] = {-1, -1};
+  std::thread thread_;
+};
+
+#endif /* end of include guard: ASYNC_QUEUE_H */
@@ -0,0 +1,80 @@
+#include "buffer_words.h"
+
+#include <algorithm>
+
+#include <absl/strings/string_view.h>
+
+namespace {
+
+// identifiers only, numbers and runs of '-' are not worth completing
+bool is_word(std::string_view token) {
+  return token.length() >= 2 &&
+         (isalpha(static_cast<unsigned char>(token[0])) || token[0] == '_');
+}
+
+}  // namespace
+
+BufferWords::Line BufferWords::tokenize(std::string_view line) {
+  Line words;
+  size_t i = 0;
+  while (i < line.length()) {
+    if (!is_word_char(line[i])) {
+      i++;
+      continue;
+    }
+    size_t start = i;
+    while (i < line.length() && is_word_char(line[i])) {
+      i++;
+    }
+    std::string_view token = line.substr(start, i - start);
+    if (!is_word(token)) {
+      continue;
+    }
+    auto it = counts_.find(absl::string_view(token.data(), token.size()));
+    if (it == counts_.end()) {
+      std::string lower = to_lower(token);
+      uint64_t mask = char_mask(lower);
+      it = counts_.emplace(std::string(token), Word{0, mask, std::move(lower)})
+               .first;
+    }
+    it->second.count++;
+    words.push_back(&it->first);
+  }
+  return words;
+}
+
+void BufferWords::release(const Line& line) {
+  for (const std::string* word : line) {
+    auto it = counts_.find(*word);
+    if (--it->second.count == 0) {
+      counts_.erase(it);
+    }
+  }
+}
+
+void BufferWords::set_lines(size_t first, size_t last,
+                            const std::vector<std::string_view>& lines) {
+  first = std::min(first, lines_.size());
+  last = std::clamp(last, first, lines_.size());
+  for (size_t i = first; i < last; ++i) {
+    release(lines_[i]);
+  }
+
+  // lines replaced one for one are the common edit, the rest only moves
+  // when the line count changes
+  size_t replaced = std::min(last - first, lines.size());
+  for (size_t i = 0; i < replaced; ++i) {
+    lines_[first + i] = tokenize(lines[i]);
+  }
+  if (replaced < last - first) {
+    lines_.erase(lines_.begin() + first + replaced, lines_.begin() + last);
+  } else if (replaced < lines.size()) {
+    std::vector<Line> added;
+    added.reserve(lines.size() - replaced);
+    for (size_t i = replaced; i < lines.size(); ++i) {
+      added.push_back(tokenize(lines[i]));
+    }
+    lines_.insert(lines_.begin() + last, std::make_move_iterator(added.begin()),
+                  std::make_move_iterator(added.end()));
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef BUFFER_WORDS_H
+#define BUFFER_WORDS_H
+
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <absl/container/node_hash_map.h>
+
+#include "packed_texts.h"
+
+// the characters of a word, also where find_last_word_index splits a line
+inline bool is_word_char(char c) {
+  return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-';
+}
+
+// The words of one buffer, kept current from the line changes nvim reports.
+// Each line remembers its words and every word counts the lines holding it,
+// so an edit only tokenizes the lines it touched and a word goes away with
+// the last line it was on.
+class BufferWords {
+ public:
+  // folded once when the word first shows up, not on every trigger
+  struct Word {
+    uint32_t count;
+    uint64_t mask;
+    std::string lower;
+  };
+
+  // Replaces lines [first, last), 0-indexed, with lines. first and last are
+  // clamped to the lines held.
+  void set_lines(size_t first, size_t last,
+                 const std::vector<std::string_view>& lines);
+
+  // every word with the number of times it appears and its folded form
+  const absl::node_hash_map<std::string, Word>& words() const {
+    return counts_;
+  }
+
+  size_t line_count() const { return lines_.size(); }
+
+ private:
+  using Line = std::vector<const std::string*>;
+
+  Line tokenize(std::string_view line);
+  void release(const Line& line);
+
+  std::vector<Line> lines_;
+  // a node map keeps the keys in place, the lines point at them
+  absl::node_hash_map<std::string, Word> counts_;
+};
+
+#endif /* end of include guard: BUFFER_WORDS_H */
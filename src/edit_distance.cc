@@ -0,0 +1,192 @@
+#include "edit_distance.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+struct Weights {
+  int ins;
+  int del;
+  int sub;
+};
+
+// x[j] = g[j] | (p[j] & x[j - 1]) with x[-1] = carry, resolved by one addition
+inline uint64_t propagate(uint64_t g, uint64_t p, uint64_t carry) {
+  p &= ~g;
+  return g | (p & (((g | p) + g + carry) ^ p));
+}
+
+// Threshold vectors are kept in padded arrays so every difference outside of
+// [-lower, upper) reads as all zero or all one bits without a branch.
+constexpr int PADDED = 3 * MAX_BIT_PARALLEL_WEIGHT + 2;
+constexpr int ORIGIN = MAX_BIT_PARALLEL_WEIGHT + 1;
+
+inline void pad(uint64_t* le, int lower, int upper) {
+  std::fill(le - ORIGIN, le - lower, 0);
+  std::fill(le + upper, le + PADDED - ORIGIN, ~0ULL);
+}
+
+inline int value_at(const uint64_t* le, int lower, int upper, int bit) {
+  int below = 0;
+  for (int t = -lower; t < upper; ++t) {
+    below += (le[t] >> bit) & 1;
+  }
+  return upper - below;
+}
+
+// Advances one 64 position block by one text character.
+//
+// v holds the vertical differences D[i][j] - D[i][j - 1] of the previous
+// column (bit j of v[t] is set when the difference is <= t, -del <= t < ins)
+// and is overwritten with the ones of the new column. h_in is the horizontal
+// difference D[i][j] - D[i - 1][j] just above the block. Returns the
+// horizontal difference at out_bit.
+inline int advance_block(const Weights& w, uint64_t eq, int h_in, uint64_t* v,
+                         uint64_t* hs, int out_bit) {
+  const int ins = w.ins;
+  const int del = w.del;
+  const int sub = w.sub;
+
+  uint64_t v_eq[MAX_BIT_PARALLEL_WEIGHT + 1];
+  for (int a = -del; a <= ins; ++a) {
+    v_eq[a + del] = v[a] & ~v[a - 1];
+  }
+
+  // h[j] = min(c - v[j], del, h[j - 1] + ins - v[j])
+  int h_below = 0;
+  for (int t = -ins; t < del; ++t) {
+    uint64_t g = (eq & ~v[-t - 1]) | (~eq & ~v[sub - t - 1]);
+    for (int a = std::max(-del, -t); a < ins; ++a) {
+      g |= v_eq[a + del] & hs[t - ins + a];
+    }
+    uint64_t carry = h_in <= t;
+    uint64_t h = propagate(g, v_eq[ins + del], carry);
+    hs[t] = (h << 1) | carry;
+    h_below += (h >> out_bit) & 1;
+  }
+
+  uint64_t h_eq[MAX_BIT_PARALLEL_WEIGHT + 1];
+  for (int b = -ins; b <= del; ++b) {
+    h_eq[b + ins] = hs[b] & ~hs[b - 1];
+  }
+
+  // v[j] = min(c - h[j - 1], v[j] + del - h[j - 1], ins)
+  uint64_t next[MAX_BIT_PARALLEL_WEIGHT];
+  for (int t = -del; t < ins; ++t) {
+    uint64_t x = (eq & ~hs[-t - 1]) | (~eq & ~hs[sub - t - 1]);
+    for (int b = std::max(-ins, -t); b <= del; ++b) {
+      x |= h_eq[b + ins] & v[t - del + b];
+    }
+    next[t + del] = x;
+  }
+  std::copy(next, next + ins + del, v - del);
+
+  return del - h_below;
+}
+
+}  // namespace
+
+bool BitParallelPattern::supports(int insert_cost, int delete_cost,
+                                  int substitude_cost, int alpha) {
+  return alpha >= 0 && insert_cost >= 0 && delete_cost >= 0 &&
+         substitude_cost >= 0 &&
+         insert_cost + delete_cost + 2 * alpha <= MAX_BIT_PARALLEL_WEIGHT;
+}
+
+BitParallelPattern::BitParallelPattern(const std::string& keyword,
+                                       int insert_cost, int delete_cost,
+                                       int substitude_cost, int alpha)
+    : keyword_(keyword),
+      length_(keyword.length()),
+      blocks_((keyword.length() + 63) / 64),
+      insert_cost_(insert_cost),
+      delete_cost_(delete_cost),
+      substitude_cost_(substitude_cost),
+      alpha_(alpha),
+      ins_(insert_cost + alpha),
+      del_(delete_cost + alpha),
+      // a substitution never costs more than a delete followed by an insert
+      sub_(std::min(substitude_cost + alpha, ins_ + del_)),
+      supported_(supports(insert_cost, delete_cost, substitude_cost, alpha)),
+      peq_(256 * blocks_) {
+  for (int c = 0; c < 256; ++c) {
+    uint64_t* mask = &peq_[c * blocks_];
+    int lower = tolower(static_cast<char>(c));
+    for (int j = 0; j < length_; ++j) {
+      if (lower == tolower(keyword_[j])) {
+        mask[j / 64] |= 1ULL << (j % 64);
+      }
+    }
+  }
+}
+
+int BitParallelPattern::distance(std::string_view text) const {
+  const int n = text.length();
+  if (length_ == 0) {
+    return n * delete_cost_;
+  }
+
+  const Weights w{ins_, del_, sub_};
+  const int k = ins_ + del_;
+  const int last_bit = (length_ - 1) % 64;
+
+  uint64_t buffer[PADDED];
+  uint64_t* v = buffer + ORIGIN;
+  pad(v, del_, ins_);
+  uint64_t h_buffer[PADDED];
+  uint64_t* hs = h_buffer + ORIGIN;
+  pad(hs, ins_, del_);
+  for (int t = -del_; t < ins_; ++t) {
+    v[t] = insert_cost_ <= t ? ~0ULL : 0;
+  }
+
+  // longer keywords swap each block in and out of the working vectors and
+  // carry the horizontal difference from one block to the next
+  std::vector<uint64_t> blocks;
+  if (blocks_ > 1) {
+    blocks.resize(blocks_ * k);
+    for (int b = 0; b < blocks_; ++b) {
+      std::copy(v - del_, v + ins_, blocks.begin() + b * k);
+    }
+  }
+
+  // D[i][m], and D[n - 1][m] with v[m] of column n - 1 for the last cell
+  int score = length_ * insert_cost_;
+  int last_score = score;
+  int last_v = insert_cost_;
+  for (int i = 0; i < n; ++i) {
+    const uint64_t* eq = peq(text[i]);
+    if (blocks_ == 1) {
+      if (i + 1 == n) {
+        last_score = score;
+        last_v = value_at(v, del_, ins_, last_bit);
+      }
+      score += advance_block(w, eq[0], delete_cost_, v, hs, last_bit);
+      continue;
+    }
+
+    int h = delete_cost_;
+    for (int b = 0; b < blocks_; ++b) {
+      auto state = blocks.begin() + b * k;
+      std::copy(state, state + k, v - del_);
+      if (i + 1 == n && b + 1 == blocks_) {
+        last_score = score;
+        last_v = value_at(v, del_, ins_, last_bit);
+      }
+      h = advance_block(w, eq[b], h, v, hs, b + 1 == blocks_ ? last_bit : 63);
+      std::copy(v - del_, v + ins_, state);
+    }
+    score += h;
+  }
+
+  // the dp drops alpha on the very last cell when both strings have the same
+  // length
+  if (n == length_ && tolower(text[n - 1]) != tolower(keyword_[n - 1])) {
+    int last = value_at(v, del_, ins_, last_bit);
+    score = std::min({last_score + delete_cost_,
+                      score - last + insert_cost_,
+                      last_score - last_v + substitude_cost_});
+  }
+  return score;
+}
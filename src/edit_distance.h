@@ -0,0 +1,109 @@
+#ifndef EDIT_DISTANCE_H
+#define EDIT_DISTANCE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "packed_texts.h"
+
+// largest insert + delete cost (alpha included) the bit-parallel kernel
+// encodes, heavier weights fall back to the dp
+constexpr int MAX_BIT_PARALLEL_WEIGHT = 16;
+
+// Bit-parallel form of the weighted edit distance in paw.cc.
+//
+// Myers/Hyyrö keep the +1/-1 differences between neighbouring dp cells as
+// bit-vectors. With weights the differences are no longer unit, so each of
+// them is stored as a set of threshold vectors (bit j of le[t] is set when the
+// difference at keyword position j is <= t). A text character then costs
+// O(weight^2) word operations no matter how long the keyword is, and
+// keywords longer than 64 characters are handled 64 positions per block.
+class BitParallelPattern {
+ public:
+  BitParallelPattern(const std::string& keyword, int insert_cost,
+                     int delete_cost, int substitude_cost, int alpha);
+
+  // false when the weights are negative or too large to encode
+  static bool supports(int insert_cost, int delete_cost, int substitude_cost,
+                       int alpha);
+  bool supported() const { return supported_; }
+
+  // the kernel spends about (insert + delete)^2 word operations per text
+  // character where the dp spends one cell per keyword character, this is
+  // the shortest keyword it wins on against the scalar loop of
+  // batch_edit_distance, measured on 20k random identifiers
+  static int crossover_length(int insert_cost, int delete_cost, int alpha) {
+    int weight = insert_cost + delete_cost + 2 * alpha;
+    return (20 + weight * weight + 1) / 2;
+  }
+  bool faster_than_dp() const {
+    return supported_ &&
+           length_ >= crossover_length(insert_cost_, delete_cost_, alpha_);
+  }
+
+  int distance(std::string_view text) const;
+
+ private:
+  const uint64_t* peq(unsigned char c) const {
+    return &peq_[static_cast<size_t>(c) * blocks_];
+  }
+
+  std::string keyword_;
+  int length_;
+  int blocks_;
+  int insert_cost_;
+  int delete_cost_;
+  int substitude_cost_;
+  int alpha_;
+  // weights of the inner cells
+  int ins_;
+  int del_;
+  int sub_;
+  bool supported_;
+  std::vector<uint64_t> peq_;
+};
+
+enum SimdLevel {
+  SCALAR,
+  SSE42,
+  AVX2,
+};
+
+SimdLevel detect_simd_level();
+
+// Runs the dp of paw.cc over the packed texts listed in order, one text per 16
+// bit lane: 16 texts at a time with avx2, 8 with sse4.2. Texts too long for a
+// lane, weights that could overflow one and cpus without either go through
+// the scalar dp. order should be sorted by length, distances is indexed by
+// text and only the entries in order are written.
+void batch_edit_distance(const PackedTexts& texts,
+                         const std::vector<uint32_t>& order,
+                         const std::string& keyword, int insert_cost,
+                         int delete_cost, int substitude_cost, int alpha,
+                         std::vector<int>& distances,
+                         SimdLevel level = detect_simd_level());
+
+// Same over order[0, count), distances must hold texts.size() entries. Slices
+// of one order can run on different threads into the same distances.
+void batch_edit_distance(const PackedTexts& texts, const uint32_t* order,
+                         size_t count, const std::string& keyword,
+                         int insert_cost, int delete_cost, int substitude_cost,
+                         int alpha, int* distances,
+                         SimdLevel level = detect_simd_level());
+
+// The batch_edit_distance over order[0, count) for one set of weights, on a
+// keyword lowercased already.
+using BatchDistance = void (*)(const PackedTexts& texts, const uint32_t* order,
+                               size_t count, const std::string& lower_keyword,
+                               int insert_cost, int delete_cost,
+                               int substitude_cost, int alpha, int* distances,
+                               SimdLevel level);
+
+// The defaults 1/1/2 and uniform 1/1/1 get kernels compiled with the costs as
+// constants and ignore the costs passed, other weights get one reading them.
+// Pick it once per set of weights instead of per call.
+BatchDistance select_batch_distance(int insert_cost, int delete_cost,
+                                    int substitude_cost);
+
+#endif /* end of include guard: EDIT_DISTANCE_H */
@@ -0,0 +1,276 @@
+#include "frecency.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+constexpr char MAGIC[4] = {'P', 'A', 'W', 'F'};
+constexpr uint32_t VERSION = 1;
+constexpr size_t INITIAL_CAPACITY = 4096;
+
+}  // namespace
+
+FrecencyStore::~FrecencyStore() { close(); }
+
+uint64_t FrecencyStore::key(uint64_t filetype_hash, uint64_t label_hash) {
+  // a splitmix64 finalizer over both, never 0 so it can't read as empty
+  uint64_t h = filetype_hash ^ (label_hash + 0x9e3779b97f4a7c15ULL +
+                                (filetype_hash << 6) + (filetype_hash >> 2));
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h ? h : 1;
+}
+
+uint32_t FrecencyStore::now_hours() {
+  using namespace std::chrono;
+  return duration_cast<hours>(system_clock::now().time_since_epoch()).count();
+}
+
+bool FrecencyStore::open(const std::string& path, double half_life_hours) {
+  close();
+  half_life_hours_ = half_life_hours > 0 ? half_life_hours : 24 * 14;
+  struct stat st;
+  // another editor may have replaced the file while this one waited for the
+  // lock, the lock only counts once it is on the file still at path
+  for (;;) {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+      return false;
+    }
+    struct stat at_path;
+    if (!lock(fd_) || fstat(fd_, &st) != 0) {
+      close();
+      return false;
+    }
+    if (stat(path.c_str(), &at_path) == 0 && at_path.st_dev == st.st_dev &&
+        at_path.st_ino == st.st_ino) {
+      break;
+    }
+    close();
+  }
+
+  bool ok;
+  if (st.st_size == 0) {
+    // nobody maps a file before its header is written, so it grows in place
+    ok = map(INITIAL_CAPACITY);
+    if (ok) {
+      init(INITIAL_CAPACITY);
+    }
+  } else {
+    Header header;
+    bool valid = static_cast<size_t>(st.st_size) >= sizeof(Header) &&
+                 pread(fd_, &header, sizeof(header), 0) == sizeof(header) &&
+                 memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                 header.version == VERSION &&
+                 header.capacity >= INITIAL_CAPACITY &&
+                 (header.capacity & (header.capacity - 1)) == 0 &&
+                 static_cast<size_t>(st.st_size) >= bytes(header.capacity);
+    // a file from another version starts over in a new file, editors still
+    // mapping the old one keep it
+    ok = valid ? map(header.capacity) : replace(path);
+  }
+  if (!ok) {
+    close();
+    return false;
+  }
+  flock(fd_, LOCK_UN);
+  return true;
+}
+
+bool FrecencyStore::lock(int fd) {
+  while (flock(fd, LOCK_EX) != 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void FrecencyStore::init(size_t capacity) {
+  memcpy(header_->magic, MAGIC, sizeof(MAGIC));
+  header_->version = VERSION;
+  header_->capacity = capacity;
+  header_->count = 0;
+}
+
+bool FrecencyStore::replace(const std::string& path) {
+  std::string temp = path + ".XXXXXX";
+  int fd = mkstemp(temp.data());
+  if (fd < 0) {
+    return false;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  // locked before it shows up at path, so an editor opening it then waits
+  // for the header
+  if (fchmod(fd, 0644) != 0 || !lock(fd)) {
+    ::close(fd);
+    unlink(temp.c_str());
+    return false;
+  }
+  int old_fd = fd_;
+  fd_ = fd;
+  if (!map(INITIAL_CAPACITY)) {
+    fd_ = old_fd;
+    ::close(fd);
+    unlink(temp.c_str());
+    return false;
+  }
+  init(INITIAL_CAPACITY);
+  if (rename(temp.c_str(), path.c_str()) != 0) {
+    unlink(temp.c_str());
+    ::close(old_fd);
+    return false;
+  }
+  ::close(old_fd);
+  return true;
+}
+
+void FrecencyStore::close() {
+  if (header_) {
+    munmap(header_, bytes(capacity_));
+    header_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  capacity_ = 0;
+}
+
+bool FrecencyStore::map(size_t capacity) {
+  size_t size = bytes(capacity);
+  struct stat st;
+  // a new file reads as zeros, which are empty slots
+  if (fstat(fd_, &st) != 0 ||
+      (static_cast<size_t>(st.st_size) < size && ftruncate(fd_, size) != 0)) {
+    return false;
+  }
+  void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  if (header_) {
+    munmap(header_, bytes(capacity_));
+  }
+  header_ = static_cast<Header*>(p);
+  capacity_ = capacity;
+  return true;
+}
+
+bool FrecencyStore::sync() {
+  if (!header_) {
+    return false;
+  }
+  if (header_->capacity == capacity_) {
+    return true;
+  }
+  if (!map(header_->capacity)) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+double FrecencyStore::decayed(const Slot& slot, uint32_t now) const {
+  double age = now > slot.hour ? now - slot.hour : 0;
+  return slot.score * std::exp2(-age / half_life_hours_);
+}
+
+double FrecencyStore::score(uint64_t key, uint32_t now) const {
+  if (!header_ || header_->capacity != capacity_) {
+    return 0;
+  }
+  const Slot* table = slots();
+  size_t mask = capacity_ - 1;
+  for (size_t i = key & mask;; i = (i + 1) & mask) {
+    if (table[i].key == key) {
+      return decayed(table[i], now);
+    }
+    if (table[i].key == 0) {
+      return 0;
+    }
+  }
+}
+
+void FrecencyStore::record(uint64_t key) {
+  // other editors write the same table, the lock keeps their probes apart
+  if (!header_ || !lock(fd_)) {
+    return;
+  }
+  if (sync()) {
+    insert(key);
+  }
+  // grow() closes the store when it fails, which drops the lock
+  if (fd_ >= 0) {
+    flock(fd_, LOCK_UN);
+  }
+}
+
+void FrecencyStore::insert(uint64_t key) {
+  // below 3/4 full a probe stays short and always finds an empty slot
+  if ((header_->count + 1) * 4 > capacity_ * 3) {
+    grow();
+    if (!header_) {
+      return;
+    }
+  }
+  uint32_t now = now_hours();
+  Slot* table = slots();
+  size_t mask = capacity_ - 1;
+  for (size_t i = key & mask;; i = (i + 1) & mask) {
+    if (table[i].key == key) {
+      table[i].score = decayed(table[i], now) + 1;
+      table[i].hour = now;
+      return;
+    }
+    if (table[i].key == 0) {
+      table[i] = Slot{key, 1, now};
+      header_->count++;
+      return;
+    }
+  }
+}
+
+// Called with the lock held. The file only ever grows, so an editor still
+// mapping the old size never touches a page past its end.
+void FrecencyStore::grow() {
+  std::vector<Slot> live;
+  live.reserve(header_->count);
+  for (size_t i = 0; i < capacity_; ++i) {
+    if (slots()[i].key != 0) {
+      live.push_back(slots()[i]);
+    }
+  }
+  size_t capacity = capacity_ * 2;
+  if (!map(capacity)) {
+    close();
+    return;
+  }
+  memset(static_cast<void*>(slots()), 0, capacity * sizeof(Slot));
+  size_t mask = capacity - 1;
+  for (const Slot& slot : live) {
+    size_t i = slot.key & mask;
+    while (slots()[i].key != 0) {
+      i = (i + 1) & mask;
+    }
+    slots()[i] = slot;
+  }
+  header_->capacity = capacity;
+  header_->count = live.size();
+}
+
+size_t FrecencyStore::bytes(size_t capacity) {
+  return sizeof(Header) + capacity * sizeof(Slot);
+}
+
+size_t FrecencyStore::size() const { return header_ ? header_->count : 0; }
@@ -0,0 +1,89 @@
+#ifndef FRECENCY_H
+#define FRECENCY_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// stable across runs, unlike absl::Hash, so it can key a file
+inline uint64_t fnv1a(std::string_view s,
+                      uint64_t h = 0xcbf29ce484222325ULL) {
+  for (unsigned char c : s) {
+    h = (h ^ c) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// How often completions were accepted, kept in an open addressing table
+// mapped straight from a file. Opening is an mmap with nothing to parse, and
+// a lookup probes the mapped slots without allocating. Keys are the hash of a
+// filetype and a label, the strings themselves are not stored. Scores halve
+// every half life since the last accept. Editors share the file: opening and
+// recording hold an flock on it, and a file that does not read as a table is
+// replaced rather than truncated under the editors that still map it.
+class FrecencyStore {
+ public:
+  FrecencyStore() = default;
+  ~FrecencyStore();
+
+  FrecencyStore(const FrecencyStore&) = delete;
+  FrecencyStore& operator=(const FrecencyStore&) = delete;
+
+  // maps path, creating it when missing, false when that fails
+  bool open(const std::string& path, double half_life_hours);
+  void close();
+  bool is_open() const { return header_ != nullptr; }
+
+  // the key of label accepted in a buffer of filetype_hash = fnv1a(filetype)
+  static uint64_t key(uint64_t filetype_hash, uint64_t label_hash);
+
+  void record(uint64_t key);
+
+  // Maps the file again when another editor grew it since it was mapped,
+  // score() reads nothing until then. false once the store is closed.
+  bool sync();
+
+  // the decayed score of key at hour now, 0 when it was never accepted
+  double score(uint64_t key, uint32_t now) const;
+
+  // hours since the epoch, the unit of the stored times
+  static uint32_t now_hours();
+
+  size_t size() const;
+
+ private:
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t count;
+  };
+
+  struct Slot {
+    // 0 marks an empty slot
+    uint64_t key;
+    float score;
+    uint32_t hour;
+  };
+
+  static size_t bytes(size_t capacity);
+  // flock of fd, false when it fails
+  static bool lock(int fd);
+  bool map(size_t capacity);
+  // writes the header of an empty table
+  void init(size_t capacity);
+  // builds an empty table in a new file, locked, and renames it over path
+  bool replace(const std::string& path);
+  void insert(uint64_t key);
+  void grow();
+  Slot* slots() const { return reinterpret_cast<Slot*>(header_ + 1); }
+  double decayed(const Slot& slot, uint32_t now) const;
+
+  int fd_ = -1;
+  Header* header_ = nullptr;
+  size_t capacity_ = 0;
+  double half_life_hours_ = 24 * 14;
+};
+
+#endif /* end of include guard: FRECENCY_H */
@@ -0,0 +1,357 @@
+#include "fzf_score.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PAW_X86
+#endif
+
+namespace {
+
+// longest text put in a lane
+constexpr int MAX_LANE_LENGTH = 512;
+
+// a cell no alignment of the keyword so far reaches, far enough below 0 that
+// a few bonuses or gaps on top of it stay below NONE / 2
+constexpr int NONE = -16384;
+
+// The state of one keyword character at the last text character: the best
+// score of an alignment ending there, whether that alignment ends in a run of
+// matches and the bonus the run started with, and whether it ends in a gap.
+struct Row {
+  int score;
+  int run;
+  int run_bonus;
+  int gap;
+};
+
+// Walks the text once with a Row per keyword character, the way the lanes do
+// below so both give the same scores.
+int scalar_score(std::string_view text, std::string_view bonuses,
+                 std::string_view keyword, std::vector<Row>& rows) {
+  const size_t m = keyword.length();
+  if (m == 0) {
+    return 0;
+  }
+  rows.assign(m, Row{NONE, 0, 0, 0});
+  int best = NONE;
+  for (size_t i = 0; i < text.length(); ++i) {
+    const int bonus = bonuses[i];
+    // the keyword before its first character matches with score 0
+    Row diag{0, 0, 0, 0};
+    for (size_t j = 0; j < m; ++j) {
+      const Row left = rows[j];
+      Row& cell = rows[j];
+      int s2 =
+          left.score + (left.gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START);
+      int s1 = NONE;
+      bool match = text[i] == keyword[j];
+      if (match) {
+        int b = bonus;
+        cell.run_bonus = bonus;
+        if (j == 0) {
+          b = bonus * BONUS_FIRST_CHAR_MULTIPLIER;
+        } else if (diag.run &&
+                   !(bonus >= BONUS_BOUNDARY && bonus > diag.run_bonus)) {
+          // a boundary inside a run starts a new one
+          b = std::max({bonus, BONUS_CONSECUTIVE, diag.run_bonus});
+          cell.run_bonus = diag.run_bonus;
+        }
+        s1 = diag.score + SCORE_MATCH + b;
+      }
+      cell.run = match && s1 >= s2;
+      cell.gap = s1 < s2;
+      int score = std::max(s1, s2);
+      cell.score = score > NONE / 2 ? std::max(score, 0) : NONE;
+      diag = left;
+    }
+    best = std::max(best, rows[m - 1].score);
+  }
+  return std::max(best, 0);
+}
+
+#ifdef PAW_X86
+
+// One text per lane, columns holds the characters and bonus_columns their
+// bonuses. rows holds the score, run, run bonus and gap of every keyword
+// character, LANES values each.
+__attribute__((target("avx2"))) void avx2_score(
+    const PackedTexts& texts, const uint32_t* index, int count,
+    std::string_view keyword, int16_t* columns, int16_t* bonus_columns,
+    int16_t* rows, int* out) {
+  constexpr int LANES = 16;
+  alignas(32) int16_t lengths[LANES] = {0};
+  int max_length = 0;
+  for (int l = 0; l < count; ++l) {
+    std::string_view text = texts.text(index[l]);
+    std::string_view bonus = texts.bonus(index[l]);
+    lengths[l] = text.length();
+    max_length = std::max<int>(max_length, text.length());
+    for (size_t i = 0; i < text.length(); ++i) {
+      columns[i * LANES + l] = static_cast<unsigned char>(text[i]);
+      bonus_columns[i * LANES + l] = bonus[i];
+    }
+  }
+
+  const int m = keyword.length();
+  const __m256i length = _mm256_load_si256((const __m256i*)lengths);
+  const __m256i none = _mm256_set1_epi16(NONE);
+  const __m256i half_none = _mm256_set1_epi16(NONE / 2);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i match = _mm256_set1_epi16(SCORE_MATCH);
+  const __m256i gap_start = _mm256_set1_epi16(SCORE_GAP_START);
+  const __m256i gap_extension = _mm256_set1_epi16(SCORE_GAP_EXTENSION);
+  const __m256i consecutive = _mm256_set1_epi16(BONUS_CONSECUTIVE);
+  const __m256i below_boundary = _mm256_set1_epi16(BONUS_BOUNDARY - 1);
+
+  __m256i* score = reinterpret_cast<__m256i*>(rows);
+  __m256i* run = score + m;
+  __m256i* run_bonus = run + m;
+  __m256i* gap = run_bonus + m;
+  for (int j = 0; j < m; ++j) {
+    _mm256_storeu_si256(score + j, none);
+    _mm256_storeu_si256(run + j, zero);
+    _mm256_storeu_si256(run_bonus + j, zero);
+    _mm256_storeu_si256(gap + j, zero);
+  }
+
+  __m256i best = none;
+  for (int i = 0; i < max_length; ++i) {
+    const __m256i active = _mm256_cmpgt_epi16(length, _mm256_set1_epi16(i));
+    const __m256i c =
+        _mm256_loadu_si256((const __m256i*)(columns + i * LANES));
+    const __m256i bonus =
+        _mm256_loadu_si256((const __m256i*)(bonus_columns + i * LANES));
+    // a boundary inside a run starts a new one
+    const __m256i boundary = _mm256_cmpgt_epi16(bonus, below_boundary);
+    __m256i diag = zero;
+    __m256i diag_run = zero;
+    __m256i diag_bonus = zero;
+    for (int j = 0; j < m; ++j) {
+      const __m256i left = _mm256_loadu_si256(score + j);
+      const __m256i left_run = _mm256_loadu_si256(run + j);
+      const __m256i left_bonus = _mm256_loadu_si256(run_bonus + j);
+      const __m256i left_gap = _mm256_loadu_si256(gap + j);
+      const __m256i eq = _mm256_and_si256(
+          active,
+          _mm256_cmpeq_epi16(
+              c, _mm256_set1_epi16(static_cast<unsigned char>(keyword[j]))));
+      const __m256i s2 = _mm256_adds_epi16(
+          left, _mm256_blendv_epi8(gap_start, gap_extension, left_gap));
+
+      __m256i b;
+      __m256i b_start = bonus;
+      if (j == 0) {
+        b = _mm256_adds_epi16(bonus, bonus);
+      } else {
+        const __m256i extend = _mm256_andnot_si256(
+            _mm256_and_si256(boundary, _mm256_cmpgt_epi16(bonus, diag_bonus)),
+            diag_run);
+        b = _mm256_blendv_epi8(
+            bonus,
+            _mm256_max_epi16(bonus, _mm256_max_epi16(consecutive, diag_bonus)),
+            extend);
+        b_start = _mm256_blendv_epi8(bonus, diag_bonus, extend);
+      }
+      __m256i s1 = _mm256_adds_epi16(_mm256_adds_epi16(diag, match), b);
+      s1 = _mm256_blendv_epi8(none, s1, eq);
+
+      const __m256i in_gap = _mm256_cmpgt_epi16(s2, s1);
+      __m256i cell = _mm256_max_epi16(s1, s2);
+      cell = _mm256_blendv_epi8(none, _mm256_max_epi16(cell, zero),
+                                _mm256_cmpgt_epi16(cell, half_none));
+      _mm256_storeu_si256(score + j, cell);
+      _mm256_storeu_si256(run + j, _mm256_andnot_si256(in_gap, eq));
+      _mm256_storeu_si256(run_bonus + j, b_start);
+      _mm256_storeu_si256(gap + j, in_gap);
+      diag = left;
+      diag_run = left_run;
+      diag_bonus = left_bonus;
+      if (j == m - 1) {
+        best = _mm256_max_epi16(best, cell);
+      }
+    }
+  }
+
+  alignas(32) int16_t result[LANES];
+  _mm256_store_si256((__m256i*)result, best);
+  for (int l = 0; l < count; ++l) {
+    out[l] = std::max<int>(result[l], 0);
+  }
+}
+
+__attribute__((target("sse4.2"))) void sse42_score(
+    const PackedTexts& texts, const uint32_t* index, int count,
+    std::string_view keyword, int16_t* columns, int16_t* bonus_columns,
+    int16_t* rows, int* out) {
+  constexpr int LANES = 8;
+  alignas(16) int16_t lengths[LANES] = {0};
+  int max_length = 0;
+  for (int l = 0; l < count; ++l) {
+    std::string_view text = texts.text(index[l]);
+    std::string_view bonus = texts.bonus(index[l]);
+    lengths[l] = text.length();
+    max_length = std::max<int>(max_length, text.length());
+    for (size_t i = 0; i < text.length(); ++i) {
+      columns[i * LANES + l] = static_cast<unsigned char>(text[i]);
+      bonus_columns[i * LANES + l] = bonus[i];
+    }
+  }
+
+  const int m = keyword.length();
+  const __m128i length = _mm_load_si128((const __m128i*)lengths);
+  const __m128i none = _mm_set1_epi16(NONE);
+  const __m128i half_none = _mm_set1_epi16(NONE / 2);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i match = _mm_set1_epi16(SCORE_MATCH);
+  const __m128i gap_start = _mm_set1_epi16(SCORE_GAP_START);
+  const __m128i gap_extension = _mm_set1_epi16(SCORE_GAP_EXTENSION);
+  const __m128i consecutive = _mm_set1_epi16(BONUS_CONSECUTIVE);
+  const __m128i below_boundary = _mm_set1_epi16(BONUS_BOUNDARY - 1);
+
+  __m128i* score = reinterpret_cast<__m128i*>(rows);
+  __m128i* run = score + m;
+  __m128i* run_bonus = run + m;
+  __m128i* gap = run_bonus + m;
+  for (int j = 0; j < m; ++j) {
+    _mm_storeu_si128(score + j, none);
+    _mm_storeu_si128(run + j, zero);
+    _mm_storeu_si128(run_bonus + j, zero);
+    _mm_storeu_si128(gap + j, zero);
+  }
+
+  __m128i best = none;
+  for (int i = 0; i < max_length; ++i) {
+    const __m128i active = _mm_cmpgt_epi16(length, _mm_set1_epi16(i));
+    const __m128i c = _mm_loadu_si128((const __m128i*)(columns + i * LANES));
+    const __m128i bonus =
+        _mm_loadu_si128((const __m128i*)(bonus_columns + i * LANES));
+    const __m128i boundary = _mm_cmpgt_epi16(bonus, below_boundary);
+    __m128i diag = zero;
+    __m128i diag_run = zero;
+    __m128i diag_bonus = zero;
+    for (int j = 0; j < m; ++j) {
+      const __m128i left = _mm_loadu_si128(score + j);
+      const __m128i left_run = _mm_loadu_si128(run + j);
+      const __m128i left_bonus = _mm_loadu_si128(run_bonus + j);
+      const __m128i left_gap = _mm_loadu_si128(gap + j);
+      const __m128i eq = _mm_and_si128(
+          active,
+          _mm_cmpeq_epi16(
+              c, _mm_set1_epi16(static_cast<unsigned char>(keyword[j]))));
+      const __m128i s2 = _mm_adds_epi16(
+          left, _mm_blendv_epi8(gap_start, gap_extension, left_gap));
+
+      __m128i b;
+      __m128i b_start = bonus;
+      if (j == 0) {
+        b = _mm_adds_epi16(bonus, bonus);
+      } else {
+        const __m128i extend = _mm_andnot_si128(
+            _mm_and_si128(boundary, _mm_cmpgt_epi16(bonus, diag_bonus)),
+            diag_run);
+        b = _mm_blendv_epi8(
+            bonus, _mm_max_epi16(bonus, _mm_max_epi16(consecutive, diag_bonus)),
+            extend);
+        b_start = _mm_blendv_epi8(bonus, diag_bonus, extend);
+      }
+      __m128i s1 = _mm_adds_epi16(_mm_adds_epi16(diag, match), b);
+      s1 = _mm_blendv_epi8(none, s1, eq);
+
+      const __m128i in_gap = _mm_cmpgt_epi16(s2, s1);
+      __m128i cell = _mm_max_epi16(s1, s2);
+      cell = _mm_blendv_epi8(none, _mm_max_epi16(cell, zero),
+                             _mm_cmpgt_epi16(cell, half_none));
+      _mm_storeu_si128(score + j, cell);
+      _mm_storeu_si128(run + j, _mm_andnot_si128(in_gap, eq));
+      _mm_storeu_si128(run_bonus + j, b_start);
+      _mm_storeu_si128(gap + j, in_gap);
+      diag = left;
+      diag_run = left_run;
+      diag_bonus = left_bonus;
+      if (j == m - 1) {
+        best = _mm_max_epi16(best, cell);
+      }
+    }
+  }
+
+  alignas(16) int16_t result[LANES];
+  _mm_store_si128((__m128i*)result, best);
+  for (int l = 0; l < count; ++l) {
+    out[l] = std::max<int>(result[l], 0);
+  }
+}
+
+#endif
+
+}  // namespace
+
+int fzf_max_score(size_t length) {
+  if (length == 0) {
+    return 0;
+  }
+  // the first character doubles its bonus, the run carries it on
+  return SCORE_MATCH * length +
+         BONUS_BOUNDARY_WHITE * (BONUS_FIRST_CHAR_MULTIPLIER + length - 1);
+}
+
+int fzf_score(const PackedTexts& texts, size_t i,
+              std::string_view lower_keyword) {
+  std::vector<Row> rows;
+  return scalar_score(texts.text(i), texts.bonus(i), lower_keyword, rows);
+}
+
+void batch_fzf_score(const PackedTexts& texts, const uint32_t* order,
+                     size_t count, const std::string& lower_keyword,
+                     int* scores, SimdLevel level) {
+  const int m = lower_keyword.length();
+  // the best score plus a gap stays inside int16_t
+  bool fits = m > 0 && fzf_max_score(m) < INT16_MAX / 2;
+  int lanes = 1;
+#ifdef PAW_X86
+  if (fits && level == AVX2) {
+    lanes = 16;
+  } else if (fits && level == SSE42) {
+    lanes = 8;
+  }
+#endif
+
+  size_t start = 0;
+  if (lanes > 1) {
+    std::vector<int16_t> columns(MAX_LANE_LENGTH * lanes);
+    std::vector<int16_t> bonus_columns(MAX_LANE_LENGTH * lanes);
+    std::vector<int16_t> rows(4 * m * lanes);
+    int out[16];
+    // order is sorted, so everything from the first text longer than a
+    // lane is left to the scalar loop below
+    while (start < count && texts.lengths[order[start]] <= MAX_LANE_LENGTH) {
+      int lane_count = 0;
+      while (lane_count < lanes && start + lane_count < count &&
+             texts.lengths[order[start + lane_count]] <= MAX_LANE_LENGTH) {
+        lane_count++;
+      }
+#ifdef PAW_X86
+      if (lanes == 16) {
+        avx2_score(texts, &order[start], lane_count, lower_keyword,
+                   columns.data(), bonus_columns.data(), rows.data(), out);
+      } else {
+        sse42_score(texts, &order[start], lane_count, lower_keyword,
+                    columns.data(), bonus_columns.data(), rows.data(), out);
+      }
+#endif
+      for (int l = 0; l < lane_count; ++l) {
+        scores[order[start + l]] = out[l];
+      }
+      start += lane_count;
+    }
+  }
+
+  std::vector<Row> rows;
+  for (; start < count; ++start) {
+    uint32_t i = order[start];
+    scores[i] =
+        scalar_score(texts.text(i), texts.bonus(i), lower_keyword, rows);
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef FZF_SCORE_H
+#define FZF_SCORE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "edit_distance.h"
+#include "packed_texts.h"
+
+// Scores of fzf v2, the bonuses are in packed_texts.h. A run of consecutive
+// matches keeps the bonus of its first character, so a word matched from its
+// start outscores the same letters scattered across the text.
+constexpr int SCORE_MATCH = 16;
+constexpr int SCORE_GAP_START = -3;
+constexpr int SCORE_GAP_EXTENSION = -1;
+constexpr int BONUS_CONSECUTIVE = -(SCORE_GAP_START + SCORE_GAP_EXTENSION);
+constexpr int BONUS_FIRST_CHAR_MULTIPLIER = 2;
+
+// the score of a keyword of length characters matched as one run from the
+// start of a text, nothing scores higher
+int fzf_max_score(size_t length);
+
+// Smith-Waterman alignment of fzf v2, the best score of the lowercased
+// keyword in text i of texts. Higher is better, 0 when it is not a
+// subsequence.
+int fzf_score(const PackedTexts& texts, size_t i,
+              std::string_view lower_keyword);
+
+// Same over the packed texts listed in order[0, count), one text per 16 bit
+// lane like batch_edit_distance: 16 texts at a time with avx2, 8 with
+// sse4.2. order should be sorted by length, scores is indexed by text and
+// only the entries in order are written.
+void batch_fzf_score(const PackedTexts& texts, const uint32_t* order,
+                     size_t count, const std::string& lower_keyword,
+                     int* scores, SimdLevel level = detect_simd_level());
+
+#endif /* end of include guard: FZF_SCORE_H */
@@ -3,79 +3,242 @@
 
 #include <absl/container/flat_hash_map.h>
 
+#include <algorithm>
+#include <functional>
+#include <limits>
 #include <list>
+#include <vector>
 
+struct CacheStats {
+  size_t entries;
+  size_t bytes;
+  size_t budget;
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+};
+
+// Least frequently used cache. Entries of the same use count share a bucket
+// ordered by when they reached that count, and a use splices the node into
+// the next bucket so values are never copied. The oldest entry of the least
+// used bucket is evicted first, once there are SIZE entries or once the
+// bytes reported through set_bytes() and set_shared_bytes() go over the
+// budget.
 template <typename T, typename U, typename F, int SIZE>
 class LFU {
  public:
-  LFU() : min_freq_(0), cache_(SIZE) {}
+  LFU()
+      : min_freq_(0),
+        bytes_(0),
+        shared_bytes_(0),
+        budget_(std::numeric_limits<size_t>::max()),
+        hits_(0),
+        misses_(0),
+        evictions_(0),
+        cache_(SIZE) {}
 
   void put(const T& key, U&& value) {
-    if (cache_.count(key)) {
-      cache_[key].second->second = std::move(value);
-      increase_use_count(key);
-    } else {
-      if ((int)cache_.size() == SIZE) {
-        auto it = data_[min_freq_].begin();
-        auto key_to_evict = it->first;
-        cache_.erase(key_to_evict);
-        data_[min_freq_].erase(it);
-      }
-
-      data_[1].push_back({key, std::move(value)});
-      auto it = prev(data_[1].end());
-      cache_[key] = {1, it};
-      min_freq_ = 1;
+    auto it = cache_.find(key);
+    if (it != cache_.end()) {
+      it->second.node->second = std::move(value);
+      increase_use_count(it->second);
+      return;
     }
+    insert(key, std::move(value));
   }
 
   bool has_value(const T& key) { return cache_.count(key); }
 
+  // looks a value up without counting it as a use
+  U* find(const T& key) {
+    auto it = cache_.find(key);
+    if (it == cache_.end()) {
+      return nullptr;
+    }
+    return &it->second.node->second;
+  }
+
+  // counts a use and a hit, or a miss without adding the key
+  U* lookup(const T& key) {
+    auto it = cache_.find(key);
+    if (it == cache_.end()) {
+      misses_++;
+      return nullptr;
+    }
+    hits_++;
+    increase_use_count(it->second);
+    return &it->second.node->second;
+  }
+
   U& get(const T& key) {
-    if (!cache_.count(key)) {
-      put(key, U{});
+    auto it = cache_.find(key);
+    if (it == cache_.end()) {
+      it = insert(key, U{});
     }
-    increase_use_count(key);
-    return cache_[key].second->second;
+    increase_use_count(it->second);
+    return it->second.node->second;
   }
 
-  void remove(const T& key) {
-    if (!cache_.count(key)) {
+  // Records how many bytes the value of key holds now and evicts other
+  // entries until the cache fits the budget again. key itself is kept.
+  void set_bytes(const T& key, size_t bytes) {
+    auto it = cache_.find(key);
+    if (it == cache_.end()) {
       return;
     }
+    bytes_ = bytes_ - it->second.bytes + bytes;
+    it->second.bytes = bytes;
+    fit(&key);
+  }
+
+  // Records the bytes held outside the values on behalf of the entries,
+  // they count toward the budget like the values do. Evicts entries other
+  // than keep until the cache fits the budget again. clear() leaves them.
+  void set_shared_bytes(size_t bytes, const T* keep = nullptr) {
+    shared_bytes_ = bytes;
+    fit(keep);
+  }
 
-    int freq = cache_[key].first;
-    auto it = cache_[key].second;
-    data_[freq].erase(it);
-    cache_.erase(key);
+  void set_budget(size_t budget) {
+    budget_ = budget;
+    fit(nullptr);
+  }
+
+  void remove(const T& key) {
+    auto it = cache_.find(key);
+    if (it == cache_.end()) {
+      return;
+    }
 
-    if (freq == min_freq_ && data_[freq].empty()) {
-      min_freq_++;
+    auto bucket = data_.find(it->second.freq);
+    bucket->second.erase(it->second.node);
+    if (bucket->second.empty()) {
+      data_.erase(bucket);
     }
+    bytes_ -= it->second.bytes;
+    cache_.erase(it);
   }
 
   void clear() {
     min_freq_ = 0;
+    bytes_ = 0;
     data_.clear();
     cache_.clear();
   }
 
+  // calls fn(key, value) for every entry, the most used and within a use
+  // count the most recently bumped first
+  void for_each(const std::function<void(const T&, const U&)>& fn) const {
+    std::vector<int> freqs;
+    for (const auto& [freq, _] : data_) {
+      freqs.push_back(freq);
+    }
+    std::sort(freqs.begin(), freqs.end(), std::greater<int>());
+    for (int freq : freqs) {
+      const Bucket& bucket = data_.at(freq);
+      for (auto node = bucket.rbegin(); node != bucket.rend(); ++node) {
+        fn(node->first, node->second);
+      }
+    }
+  }
+
+  CacheStats stats() const {
+    return CacheStats{cache_.size(), bytes_ + shared_bytes_, budget_,
+                      hits_,         misses_,                evictions_};
+  }
+
  private:
+  using Bucket = std::list<std::pair<T, U>>;
+
+  struct Entry {
+    int freq;
+    typename Bucket::iterator node;
+    size_t bytes;
+  };
+
   int min_freq_;
-  absl::flat_hash_map<int, std::list<std::pair<T, U>>> data_;
-  absl::flat_hash_map<
-      T, std::pair<int, typename std::list<std::pair<T, U>>::iterator>, F>
-      cache_;
-
-  void increase_use_count(const T& key) {
-    int freq = cache_[key].first;
-    auto it = cache_[key].second;
-    std::pair<T, U> new_p = *it;
-    data_[freq].erase(it);
-    data_[freq + 1].push_back(new_p);
-    cache_[key] = {freq + 1, prev(data_[freq + 1].end())};
-    if (freq == min_freq_ && data_[freq].empty()) {
-      min_freq_++;
+  size_t bytes_;
+  size_t shared_bytes_;
+  size_t budget_;
+  size_t hits_;
+  size_t misses_;
+  size_t evictions_;
+  // empty buckets are erased, so every bucket here holds entries
+  absl::flat_hash_map<int, Bucket> data_;
+  absl::flat_hash_map<T, Entry, F> cache_;
+
+  typename absl::flat_hash_map<T, Entry, F>::iterator insert(const T& key,
+                                                             U&& value) {
+    if ((int)cache_.size() == SIZE) {
+      evict(nullptr);
+    }
+
+    Bucket& bucket = data_[1];
+    bucket.emplace_back(key, std::move(value));
+    min_freq_ = 1;
+    return cache_.emplace(key, Entry{1, std::prev(bucket.end()), 0}).first;
+  }
+
+  // evicts entries other than keep while the cache is over the budget
+  void fit(const T* keep) {
+    while (bytes_ + shared_bytes_ > budget_ && !cache_.empty()) {
+      if (keep && cache_.size() == 1 && cache_.count(*keep)) {
+        return;
+      }
+      evict(keep);
+    }
+  }
+
+  // evicts the least used entry other than keep
+  void evict(const T* keep) {
+    // remove() can empty the least used bucket without knowing the next one
+    if (!data_.count(min_freq_)) {
+      min_freq_ = data_.begin()->first;
+      for (const auto& [freq, _] : data_) {
+        min_freq_ = std::min(min_freq_, freq);
+      }
+    }
+
+    auto bucket = data_.find(min_freq_);
+    auto node = bucket->second.begin();
+    if (keep && node->first == *keep) {
+      if (std::next(node) == bucket->second.end()) {
+        // keep is alone in the least used bucket, take the next bucket
+        int next = std::numeric_limits<int>::max();
+        for (const auto& [freq, _] : data_) {
+          if (freq > min_freq_) {
+            next = std::min(next, freq);
+          }
+        }
+        bucket = data_.find(next);
+        node = bucket->second.begin();
+      } else {
+        ++node;
+      }
+    }
+
+    auto it = cache_.find(node->first);
+    bytes_ -= it->second.bytes;
+    cache_.erase(it);
+    bucket->second.erase(node);
+    if (bucket->second.empty()) {
+      data_.erase(bucket);
+    }
+    evictions_++;
+  }
+
+  void increase_use_count(Entry& entry) {
+    int freq = entry.freq;
+    // data_[freq + 1] can rehash, so look the old bucket up after it
+    Bucket& next = data_[freq + 1];
+    auto bucket = data_.find(freq);
+    next.splice(next.end(), bucket->second, entry.node);
+    entry.freq = freq + 1;
+    if (bucket->second.empty()) {
+      data_.erase(bucket);
+      if (freq == min_freq_) {
+        min_freq_ = freq + 1;
+      }
     }
   }
 };
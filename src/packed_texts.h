@@ -0,0 +1,203 @@
+#ifndef PACKED_TEXTS_H
+#define PACKED_TEXTS_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+
+inline std::string to_lower(std::string_view s) {
+  std::string lower(s.length(), '\0');
+  std::transform(s.begin(), s.end(), lower.begin(),
+                 [](char c) { return tolower(c); });
+  return lower;
+}
+
+// A bit per letter, digit, '_' and '-', other bytes share the remaining
+// bits. A text can only contain a keyword as a subsequence when its mask
+// covers the mask of the keyword.
+inline int char_bit(unsigned char c) {
+  if (c >= 'a' && c <= 'z') {
+    return c - 'a';
+  }
+  if (c >= '0' && c <= '9') {
+    return 26 + (c - '0');
+  }
+  if (c == '_') {
+    return 36;
+  }
+  if (c == '-') {
+    return 37;
+  }
+  return 38 + c % 26;
+}
+
+inline uint64_t char_mask(std::string_view lower) {
+  uint64_t mask = 0;
+  for (unsigned char c : lower) {
+    mask |= uint64_t(1) << char_bit(c);
+  }
+  return mask;
+}
+
+// whether keyword appears in text in order, both lowercased already
+inline bool is_subsequence(std::string_view text, std::string_view keyword) {
+  if (keyword.empty()) {
+    return true;
+  }
+  for (size_t k = 0, j = 0; k < text.length(); ++k) {
+    if (text[k] == keyword[j] && ++j == keyword.length()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Bonuses of fzf v2 for matching a character, by the class of the character
+// before it. Starts of words and camelCase humps score above the middle of a
+// word, a text starts after whitespace.
+constexpr int BONUS_BOUNDARY_WHITE = 10;
+constexpr int BONUS_BOUNDARY_DELIMITER = 9;
+constexpr int BONUS_BOUNDARY = 8;
+constexpr int BONUS_NON_WORD = 8;
+constexpr int BONUS_CAMEL = 7;
+
+// ordered like fzf, the classes after NON_WORD start a word
+enum class CharClass {
+  WHITE,
+  NON_WORD,
+  DELIMITER,
+  LOWER,
+  UPPER,
+  LETTER,
+  NUMBER,
+};
+
+inline CharClass char_class(unsigned char c) {
+  if (c >= 'a' && c <= 'z') {
+    return CharClass::LOWER;
+  }
+  if (c >= 'A' && c <= 'Z') {
+    return CharClass::UPPER;
+  }
+  if (c >= '0' && c <= '9') {
+    return CharClass::NUMBER;
+  }
+  if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+    return CharClass::WHITE;
+  }
+  if (c == '/' || c == ',' || c == ':' || c == ';' || c == '|') {
+    return CharClass::DELIMITER;
+  }
+  // bytes of multibyte characters
+  return c >= 0x80 ? CharClass::LETTER : CharClass::NON_WORD;
+}
+
+inline int boundary_bonus(CharClass prev, CharClass c) {
+  if (c > CharClass::NON_WORD) {
+    if (prev == CharClass::WHITE) {
+      return BONUS_BOUNDARY_WHITE;
+    }
+    if (prev == CharClass::DELIMITER) {
+      return BONUS_BOUNDARY_DELIMITER;
+    }
+    if (prev == CharClass::NON_WORD) {
+      return BONUS_BOUNDARY;
+    }
+  }
+  if ((prev == CharClass::LOWER && c == CharClass::UPPER) ||
+      (prev != CharClass::NUMBER && c == CharClass::NUMBER)) {
+    return BONUS_CAMEL;
+  }
+  if (c == CharClass::NON_WORD || c == CharClass::DELIMITER) {
+    return BONUS_NON_WORD;
+  }
+  return c == CharClass::WHITE ? BONUS_BOUNDARY_WHITE : 0;
+}
+
+// The text every completion item is scored on, lowercased once on insert and
+// stored back to back so the scoring pass walks flat arrays instead of the
+// optional strings in CompletionItem.
+struct PackedTexts {
+  std::string lower;
+  // boundary_bonus() of every character of lower, taken from the text before
+  // lowercasing since camelCase humps are gone after
+  std::string bonuses;
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> lengths;
+  // char_mask() of every text
+  std::vector<uint64_t> masks;
+  // indices ordered by length, a batch of simd lanes then runs for about the
+  // same number of characters
+  std::vector<uint32_t> by_length;
+
+  size_t size() const { return offsets.size(); }
+
+  std::string_view text(size_t i) const {
+    return std::string_view(lower.data() + offsets[i], lengths[i]);
+  }
+
+  std::string_view bonus(size_t i) const {
+    return std::string_view(bonuses.data() + offsets[i], lengths[i]);
+  }
+
+  void push_back(std::string_view text) {
+    offsets.push_back(lower.length());
+    lengths.push_back(text.length());
+    lower += to_lower(text);
+    CharClass prev = CharClass::WHITE;
+    for (unsigned char c : text) {
+      CharClass cls = char_class(c);
+      bonuses.push_back(static_cast<char>(boundary_bonus(prev, cls)));
+      prev = cls;
+    }
+    masks.push_back(char_mask(std::string_view(lower).substr(offsets.back())));
+  }
+
+  // drops the last text, only before it was sorted in
+  void pop_back() {
+    lower.resize(offsets.back());
+    bonuses.resize(offsets.back());
+    offsets.pop_back();
+    lengths.pop_back();
+    masks.pop_back();
+  }
+
+  // Call once after a run of push_back. Only the new texts are sorted and
+  // then merged in, so inserting a response in chunks stays linear.
+  void sort_by_length() {
+    size_t sorted = by_length.size();
+    by_length.resize(size());
+    std::iota(by_length.begin() + sorted, by_length.end(), sorted);
+    auto shorter = [this](uint32_t a, uint32_t b) {
+      return lengths[a] < lengths[b];
+    };
+    std::stable_sort(by_length.begin() + sorted, by_length.end(), shorter);
+    std::inplace_merge(by_length.begin(), by_length.begin() + sorted,
+                       by_length.end(), shorter);
+  }
+
+  // the keyword is lowercased already and keyword_mask is its char_mask()
+  bool is_subsequence(size_t i, std::string_view lower_keyword,
+                      uint64_t keyword_mask) const {
+    // most texts miss some character of the keyword
+    if ((masks[i] & keyword_mask) != keyword_mask) {
+      return false;
+    }
+    return ::is_subsequence(text(i), lower_keyword);
+  }
+
+  void clear() {
+    lower.clear();
+    bonuses.clear();
+    offsets.clear();
+    lengths.clear();
+    masks.clear();
+    by_length.clear();
+  }
+};
+
+#endif /* end of include guard: PACKED_TEXTS_H */
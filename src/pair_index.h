@@ -0,0 +1,95 @@
+#ifndef PAIR_INDEX_H
+#define PAIR_INDEX_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+#include <vector>
+
+#include "packed_texts.h"
+
+// Inverted index of the ordered character pairs of a list's texts, the
+// subsequence counterpart of a bigram index. The posting list of (x, y)
+// holds every text with a character of char_bit() x somewhere before one of
+// char_bit() y. A text containing the keyword as a subsequence contains each
+// pair of adjacent keyword characters that way, so intersecting their
+// postings gives a superset of the matches without walking every text.
+//
+// Postings hold positions in texts.by_length rather than text indices, the
+// candidates then come out in the order the linear scan visits them.
+class PairIndex {
+ public:
+  static constexpr int BITS = 64;
+
+  bool empty() const { return postings_.empty(); }
+
+  void build(const PackedTexts& texts) {
+    postings_.assign(BITS * BITS, {});
+    // before[y], the bits seen before the last y so far in the current text
+    uint64_t before[BITS] = {};
+    for (uint32_t rank = 0; rank < texts.by_length.size(); ++rank) {
+      uint64_t seen = 0;
+      for (unsigned char c : texts.text(texts.by_length[rank])) {
+        int y = char_bit(c);
+        before[y] |= seen;
+        seen |= uint64_t(1) << y;
+      }
+      for (uint64_t ys = seen; ys; ys &= ys - 1) {
+        int y = __builtin_ctzll(ys);
+        for (uint64_t xs = before[y]; xs; xs &= xs - 1) {
+          postings_[__builtin_ctzll(xs) * BITS + y].push_back(rank);
+        }
+        before[y] = 0;
+      }
+    }
+    for (auto& posting : postings_) {
+      posting.shrink_to_fit();
+    }
+  }
+
+  // Positions in texts.by_length that may match lower_keyword, in
+  // increasing order. Keywords shorter than two characters have no pair and
+  // return false, every text is a candidate then.
+  bool candidates(std::string_view lower_keyword,
+                  std::vector<uint32_t>& out) const {
+    std::vector<const std::vector<uint32_t>*> lists;
+    for (size_t i = 1; i < lower_keyword.length(); ++i) {
+      lists.push_back(&postings_[char_bit(lower_keyword[i - 1]) * BITS +
+                                 char_bit(lower_keyword[i])]);
+    }
+    if (lists.empty()) {
+      return false;
+    }
+    // the shortest list first keeps every intersection small
+    std::sort(lists.begin(), lists.end(), [](auto* a, auto* b) {
+      return a->size() != b->size() ? a->size() < b->size() : a < b;
+    });
+    lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+
+    out = *lists[0];
+    std::vector<uint32_t> next;
+    for (size_t k = 1; k < lists.size() && !out.empty(); ++k) {
+      next.clear();
+      std::set_intersection(out.begin(), out.end(), lists[k]->begin(),
+                            lists[k]->end(), std::back_inserter(next));
+      out.swap(next);
+    }
+    return true;
+  }
+
+  size_t bytes() const {
+    size_t bytes = postings_.capacity() * sizeof(std::vector<uint32_t>);
+    for (const auto& posting : postings_) {
+      bytes += posting.capacity() * sizeof(uint32_t);
+    }
+    return bytes;
+  }
+
+  void clear() { std::vector<std::vector<uint32_t>>().swap(postings_); }
+
+ private:
+  std::vector<std::vector<uint32_t>> postings_;
+};
+
+#endif /* end of include guard: PAIR_INDEX_H */
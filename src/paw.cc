@@ -5,12 +5,19 @@ extern "C" {
 #include "lua.h"
 }
 
+#include <absl/hash/hash.h>
 #include <absl/strings/str_format.h>
 
 #include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <new>
 #include <vector>
 
+#include "edit_distance.h"
+#include "fzf_score.h"
 #include "paw.h"
+#include "position_encoding.h"
 
 #define MAX_STARS 5
 
@@ -23,6 +30,15 @@ std::string trim(const std::string& str) {
   return str.substr(first, (last - first + 1));
 }
 
+std::string_view trim_view(std::string_view str) {
+  size_t first = str.find_first_not_of(" \t\n\r");
+  if (first == std::string_view::npos) {
+    return std::string_view();
+  }
+  size_t last = str.find_last_not_of(" \t\n\r");
+  return str.substr(first, (last - first + 1));
+}
+
 std::string trim_long_text(const std::string& s, size_t max_len) {
   if (s.length() > max_len) {
     return s.substr(0, max_len) + "...";
@@ -99,8 +115,6 @@ int lua_is_whitespace(lua_State* L) {
   return 1;
 }
 
-bool is_word_char(char c) { return isalnum(c) || c == '_' || c == '-'; }
-
 int lua_find_last_word_index(lua_State* L) {
   const char* input = luaL_checkstring(L, 1);
   size_t len = strlen(input);
@@ -146,7 +160,7 @@ int lua_find_last_trigger_index(lua_State* L) {
 // given a table and a list
 // retrieve the value from table[list[1]][list[1]][...]
 int lua_table_get(lua_State* L) {
-  if (!lua_istable(L, 1) || !lua_istable(L, 2)) {
+  if (!(lua_istable(L, 1) || lua_isuserdata(L, 1)) || !lua_istable(L, 2)) {
     lua_pushnil(L);
     return 1;
   }
@@ -241,49 +255,119 @@ std::optional<Range> get_optional_range(lua_State* L, const char* key) {
   return range;
 }
 
-std::optional<TextEdit> get_optional_text_edit(lua_State* L, const char* key) {
+// the returned view points into the Lua string, which the table keeps alive
+std::optional<std::string_view> get_optional_string_view(lua_State* L,
+                                                         const char* key) {
+  lua_getfield(L, -1, key);
+  std::optional<std::string_view> result;
+  if (lua_isstring(L, -1)) {
+    size_t length = 0;
+    const char* s = lua_tolstring(L, -1, &length);
+    result = std::string_view(s, length);
+  }
+  lua_pop(L, 1);
+  return result;
+}
+
+StringRef get_arena_string(lua_State* L, const char* key, StringArena& arena) {
+  auto s = get_optional_string_view(L, key);
+  return s ? arena.add(*s) : StringRef{};
+}
+
+std::optional<TextEdit> get_optional_text_edit(lua_State* L, const char* key,
+                                               CompletionList& list) {
   lua_getfield(L, -1, key);
   std::optional<TextEdit> edit;
   if (lua_istable(L, -1)) {
-    auto new_text = get_optional_string(L, "newText");
+    auto new_text = get_optional_string_view(L, "newText");
     edit.emplace(TextEdit{
-        .new_text = new_text ? *new_text : "",
-        .range = get_optional_range(L, "range"),
-        .insert = get_optional_range(L, "insert"),
-        .replace = get_optional_range(L, "replace"),
+        .new_text = list.strings.add(new_text ? *new_text : ""),
+        .first_range = static_cast<uint32_t>(list.ranges.size()),
+        .ranges = 0,
     });
+    const std::pair<const char*, TextEditRange> ranges[] = {
+        {"range", RANGE}, {"insert", INSERT}, {"replace", REPLACE}};
+    for (auto [name, bit] : ranges) {
+      if (auto range = get_optional_range(L, name)) {
+        list.ranges.push_back(*range);
+        edit->ranges |= bit;
+      }
+    }
   }
   lua_pop(L, 1);
   return edit;
 }
 
-CompletionItem parse_completion_item(lua_State* L) {
+CompletionItem parse_completion_item(lua_State* L, CompletionList& list,
+                                     InternPool& interned) {
   CompletionItem item;
-  auto label = get_optional_string(L, "label");
-  item.label = label ? trim(*label) : "";
+  auto label = get_optional_string_view(L, "label");
+  item.label = list.strings.add(label ? trim_view(*label) : "");
   item.kind = get_completion_item_kind(L, "kind");
-  item.detail = get_optional_string(L, "detail");
-  item.sort_text = get_optional_string(L, "sortText");
-  item.filter_text = get_optional_string(L, "filterText");
-  item.insert_text = get_optional_string(L, "insertText");
+  if (auto detail = get_optional_string_view(L, "detail")) {
+    item.detail = interned.intern(*detail);
+  }
+  item.sort_text = get_arena_string(L, "sortText", list.strings);
+  item.filter_text = get_arena_string(L, "filterText", list.strings);
+  item.insert_text = get_arena_string(L, "insertText", list.strings);
   item.insert_text_format = get_optional_int(L, "insertTextFormat");
-  item.text_edit = get_optional_text_edit(L, "textEdit");
+  item.text_edit = get_optional_text_edit(L, "textEdit", list);
   return item;
 }
 
-std::vector<CompletionItem> parse_completion_items(lua_State* L) {
+// the strings of the items go straight into the arena of list
+std::vector<CompletionItem> parse_completion_items(lua_State* L,
+                                                   CompletionList& list,
+                                                   InternPool& interned) {
   std::vector<CompletionItem> items;
 
   lua_pushnil(L);
   while (lua_next(L, -2) != 0) {
     if (lua_istable(L, -1)) {
-      items.push_back(parse_completion_item(L));
+      items.push_back(parse_completion_item(L, list, interned));
     }
     lua_pop(L, 1);
   }
   return items;
 }
 
+// Items parsed from Lua before the mutex is taken, so a luaL_error on a bad
+// item cannot leave it locked. Their strings and ranges go into a list of
+// their own and their details into a pool of their own until move_parsed.
+struct ParsedItems {
+  CompletionList list;
+  InternPool details;
+  std::vector<CompletionItem> items;
+};
+
+// Moves the strings, ranges and details of parsed into list and interned,
+// pointing the items at them.
+void move_parsed(ParsedItems& parsed, CompletionList& list,
+                 InternPool& interned) {
+  const uint32_t strings = list.strings.append(parsed.list.strings);
+  const uint32_t ranges = list.ranges.size();
+  list.ranges.insert(list.ranges.end(), parsed.list.ranges.begin(),
+                     parsed.list.ranges.end());
+  auto rebase = [strings](StringRef& ref) {
+    if (ref.has_value()) {
+      ref.offset += strings;
+    }
+  };
+  for (CompletionItem& item : parsed.items) {
+    rebase(item.label);
+    rebase(item.sort_text);
+    rebase(item.filter_text);
+    rebase(item.insert_text);
+    if (item.detail != InternPool::NONE) {
+      item.detail = interned.intern(parsed.details.get(item.detail));
+    }
+    if (item.text_edit) {
+      rebase(item.text_edit->new_text);
+      item.text_edit->first_range += ranges;
+    }
+  }
+}
+
 void push_position(lua_State* L, const Position& p) {
   lua_newtable(L);
   lua_pushinteger(L, p.line);
@@ -300,59 +384,86 @@ void push_range(lua_State* L, const Range& r) {
   lua_setfield(L, -2, "end");
 }
 
-void push_text_edit(lua_State* L, const TextEdit& edit) {
-  lua_newtable(L);
-  lua_pushstring(L, edit.new_text.c_str());
-  lua_setfield(L, -2, "newText");
+void push_lstring(lua_State* L, std::string_view s) {
+  lua_pushlstring(L, s.data(), s.length());
+}
 
-  if (edit.range) {
-    push_range(L, *edit.range);
-    lua_setfield(L, -2, "range");
+std::string_view get_text(const CompletionList& list,
+                          const CompletionItem& item) {
+  if (item.filter_text.has_value()) {
+    return list.strings.get(item.filter_text);
   }
+  if (item.insert_text.has_value()) {
+    return list.strings.get(item.insert_text);
+  }
+  return list.strings.get(item.label);
+}
 
-  if (edit.insert) {
-    push_range(L, *edit.insert);
-    lua_setfield(L, -2, "insert");
+// Pushes the text edit of an item completing word, items without one replace
+// the word with their text.
+void push_text_edit(lua_State* L, const CompletionList& list,
+                    const CompletionItem& item, const WordRange& word) {
+  lua_newtable(L);
+  if (!item.text_edit) {
+    push_lstring(L, get_text(list, item));
+    lua_setfield(L, -2, "newText");
+    Position s = {word.line - 1, word.start - 1};
+    Position e = {word.line - 1, word.cursor};
+    push_range(L, Range{s, e});
+    lua_setfield(L, -2, "range");
+    return;
   }
 
-  if (edit.replace) {
-    push_range(L, *edit.replace);
-    lua_setfield(L, -2, "replace");
+  const TextEdit& edit = *item.text_edit;
+  push_lstring(L, list.strings.get(edit.new_text));
+  lua_setfield(L, -2, "newText");
+
+  const std::pair<const char*, TextEditRange> ranges[] = {
+      {"range", RANGE}, {"insert", INSERT}, {"replace", REPLACE}};
+  uint32_t index = edit.first_range;
+  for (auto [name, bit] : ranges) {
+    if (edit.ranges & bit) {
+      Range range = list.ranges[index++];
+      range.end.character = word.cursor;
+      push_range(L, range);
+      lua_setfield(L, -2, name);
+    }
   }
 }
 
-void push_completion_item(lua_State* L, const CompletionItem& item) {
+void push_completion_item(lua_State* L, const CompletionList& list,
+                          const CompletionItem& item,
+                          const InternPool& interned, const WordRange& word) {
   lua_newtable(L);
-  lua_pushstring(L, item.label.c_str());
+  push_lstring(L, list.strings.get(item.label));
   lua_setfield(L, -2, "label");
   if (item.kind) {
     lua_pushinteger(L, *item.kind);
     lua_setfield(L, -2, "kind");
   }
-  if (item.detail) {
-    lua_pushstring(L, item.detail->c_str());
+  if (item.detail != InternPool::NONE) {
+    push_lstring(L, interned.get(item.detail));
     lua_setfield(L, -2, "detail");
   }
-  if (item.sort_text) {
-    lua_pushstring(L, item.sort_text->c_str());
+  if (item.sort_text.has_value()) {
+    push_lstring(L, list.strings.get(item.sort_text));
     lua_setfield(L, -2, "sortText");
   }
-  if (item.filter_text) {
-    lua_pushstring(L, item.filter_text->c_str());
+  if (item.filter_text.has_value()) {
+    push_lstring(L, list.strings.get(item.filter_text));
     lua_setfield(L, -2, "filterText");
   }
-  if (item.insert_text) {
-    lua_pushstring(L, item.insert_text->c_str());
+  if (item.insert_text.has_value()) {
+    push_lstring(L, list.strings.get(item.insert_text));
     lua_setfield(L, -2, "insertText");
   }
   if (item.insert_text_format) {
     lua_pushinteger(L, *item.insert_text_format);
     lua_setfield(L, -2, "insertTextFormat");
   }
-  if (item.text_edit) {
-    push_text_edit(L, *item.text_edit);
-    lua_setfield(L, -2, "textEdit");
-  }
+  push_text_edit(L, list, item, word);
+  lua_setfield(L, -2, "textEdit");
+
   lua_pushnumber(L, item.client_id);
   lua_setfield(L, -2, "clientId");
 
@@ -360,21 +471,13 @@ void push_completion_item(lua_State* L, const CompletionItem& item) {
   lua_setfield(L, -2, "cost");
 }
 
-void push_completion_items(lua_State* L,
-                           const std::vector<CompletionItem>& items) {
-  lua_newtable(L);
-  int index = 1;
-  for (const auto& item : items) {
-    push_completion_item(L, item);
-    lua_rawseti(L, -2, index++);
-  }
-}
-
 EditDistanceOption parse_edit_distance_option(lua_State* L) {
   EditDistanceOption option;
-  option.keyword = get_optional_string(L, "keyword")
-                       ? *get_optional_string(L, "keyword")
-                       : "";
+  option.keyword = get_optional_string(L, "keyword").value_or("");
+
+  // "fzf", anything else scores by edit distance
+  option.scorer =
+      get_optional_string(L, "scorer") == "fzf" ? FZF : LEVENSHTEIN;
 
   lua_getfield(L, -1, "insert_cost");
   option.insert_cost = luaL_optinteger(L, -1, 0);
@@ -407,6 +510,36 @@ EditDistanceOption parse_edit_distance_option(lua_State* L) {
   option.gamma = luaL_optnumber(L, -1, 0.1);
   lua_pop(L, 1);
 
+  // "dp", "bit_parallel" or "simd", anything else picks the fastest one
+  auto kernel = get_optional_string(L, "kernel");
+  option.kernel = AUTO;
+  if (kernel == "dp") {
+    option.kernel = DP;
+  } else if (kernel == "bit_parallel") {
+    option.kernel = BIT_PARALLEL;
+  } else if (kernel == "simd") {
+    option.kernel = SIMD;
+  }
+
+  lua_getfield(L, -1, "max_results");
+  option.max_results = std::max(0, (int)luaL_optinteger(L, -1, 0));
+  lua_pop(L, 1);
+
+  lua_getfield(L, -1, "lazy");
+  option.lazy = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, -1, "index_threshold");
+  option.index_threshold = std::max(0, (int)luaL_optinteger(L, -1, 0));
+  lua_pop(L, 1);
+
+  option.filetype = get_optional_string(L, "filetype").value_or("");
+
+  lua_getfield(L, -1, "frecency_boost");
+  option.frecency_boost = std::max(0.0, luaL_optnumber(L, -1, 0.0));
+  lua_pop(L, 1);
+
+  settle_kernel(option);
   return option;
 }
 
@@ -428,9 +561,9 @@ CompletionParam parse_completion_param(lua_State* L) {
   return param;
 }
 
-std::pair<int, bool> edit_distance(const std::string& s1,
-                                   const EditDistanceOption& option) {
-  const std::string& s2 = option.keyword;
+// the items scored are subsequence matches already, see refine_survivors
+int edit_distance(std::string_view s1, const EditDistanceOption& option) {
+  std::string_view s2 = option.keyword;
   const int insert_cost = option.insert_cost;
   const int delete_cost = option.delete_cost;
   const int substitude_cost = option.substitude_cost;
@@ -459,100 +592,269 @@ std::pair<int, bool> edit_distance(const std::string& s1,
     }
     dp = next_dp;
   }
-  bool is_subseq = false;
-  if (len2 > 0) {
-    for (size_t i = 0, j = 0; i < len1; ++i) {
-      if (tolower(s1[i]) == tolower(s2[j])) {
-        j++;
-      }
-      if (j == len2) {
-        is_subseq = true;
-        break;
-      }
+  return dp[len2];
+}
+
+void settle_kernel(EditDistanceOption& option) {
+  const int insert_cost = option.insert_cost;
+  const int delete_cost = option.delete_cost;
+  const int substitude_cost = option.substitude_cost;
+  option.batch_distance =
+      select_batch_distance(insert_cost, delete_cost, substitude_cost);
+  option.largest_cost = std::max({insert_cost, delete_cost, substitude_cost});
+  option.bit_parallel_length = std::numeric_limits<int>::max();
+  option.settled_kernel = option.kernel;
+
+  bool supported = BitParallelPattern::supports(insert_cost, delete_cost,
+                                                substitude_cost, option.alpha);
+  if (option.kernel == BIT_PARALLEL && !supported) {
+    option.settled_kernel = DP;
+  } else if (option.kernel == AUTO) {
+    // the batched dp is the fastest unless it has to run without simd, then
+    // the bit-parallel kernel wins on long enough keywords
+    if (detect_simd_level() != SCALAR || !supported) {
+      option.settled_kernel = SIMD;
+    } else {
+      option.bit_parallel_length = BitParallelPattern::crossover_length(
+          insert_cost, delete_cost, option.alpha);
     }
-  } else {
-    is_subseq = true;
   }
-  return {dp[len2], is_subseq};
 }
 
-struct CompareCompletionItem {
-  bool operator()(const CompletionItem& a, const CompletionItem& b) {
-    int format_a = a.insert_text_format ? *a.insert_text_format : 1;
-    int format_b = b.insert_text_format ? *b.insert_text_format : 1;
-    if (format_a == format_b) {
-      double cost_a = a.cost;
-      double cost_b = b.cost;
+int longest_common_prefix(std::string_view s1, std::string_view s2) {
+  int n = std::min(s1.length(), s2.length());
+  for (int i = 0; i < n; ++i) {
+    if (s1[i] != s2[i]) {
+      return i;
+    }
+  }
+  return n;
+}
 
-      if (cost_a != cost_b) {
-        return cost_a < cost_b;
-      }
+double compute_cost(std::string_view text, int dist, std::string_view keyword,
+                    const EditDistanceOption& option) {
+  if (keyword.length() == 0 && text.length() == 0) {
+    return std::numeric_limits<int>::max();
+  }
+  int C = option.largest_cost;
+  double P = longest_common_prefix(text, keyword);
+  double W = std::max(keyword.length(), text.length());
+  int L = keyword.length();
+  double cost = (double)dist / (W * C) - (L == 0 ? 0 : option.beta * (P / L)) +
+                (option.gamma * text.length() / W);
+  return cost;
+}
 
-      if (a.sort_text && b.sort_text) {
-        return *a.sort_text < *b.sort_text;
-      }
-      return a.label < b.label;
+// The part of the best fzf score a text misses. gamma stays below one point
+// of score and only breaks ties toward shorter texts.
+double compute_fzf_cost(size_t length, int score, std::string_view keyword,
+                        const EditDistanceOption& option) {
+  const size_t L = keyword.length();
+  if (L == 0 && length == 0) {
+    return std::numeric_limits<int>::max();
+  }
+  double best = std::max(fzf_max_score(L), 1);
+  double W = std::max(L, length);
+  return (best - score + option.gamma * (W - L) / W) / best;
+}
+
+// Narrows list.survivors down to the items matching the keyword, starting
+// from the last survivors when the keyword only grew since the last call.
+// Otherwise a list of index_threshold items or more only checks the
+// candidates of its PairIndex, in the same order as the full scan.
+void refine_survivors(CompletionList& list, const std::string& lower_keyword,
+                      int index_threshold) {
+  bool extends = list.refinable &&
+                 lower_keyword.compare(0, list.last_keyword.length(),
+                                       list.last_keyword) == 0;
+  std::vector<uint32_t> indexed;
+  bool use_index = !extends && index_threshold > 0 &&
+                   list.texts.size() >= static_cast<size_t>(index_threshold);
+  if (use_index) {
+    if (list.index.empty()) {
+      list.index.build(list.texts);
+    }
+    use_index = list.index.candidates(lower_keyword, indexed);
+    for (uint32_t& rank : indexed) {
+      rank = list.texts.by_length[rank];
     }
-    return format_a > format_b;
   }
-};
+  const std::vector<uint32_t>& candidates =
+      extends ? list.survivors : use_index ? indexed : list.texts.by_length;
+  std::vector<uint32_t> survivors;
+  const uint64_t keyword_mask = char_mask(lower_keyword);
+  for (uint32_t i : candidates) {
+    if (list.texts.is_subsequence(i, lower_keyword, keyword_mask)) {
+      survivors.push_back(i);
+    }
+  }
+  list.survivors.swap(survivors);
+  list.last_keyword = lower_keyword;
+  list.refinable = true;
+}
 
-std::string& get_text(CompletionItem& item) {
-  if (item.filter_text) {
-    return *item.filter_text;
+// below this many survivors waking the workers costs more than it saves
+constexpr size_t PARALLEL_THRESHOLD = 4096;
+constexpr size_t MIN_CHUNK = 1024;
+
+// Calls fn(begin, end) over [0, n), in chunks on workers once n is large
+// enough. fn must only write what its own chunk owns.
+void for_chunks(WorkerPool* workers, size_t n,
+                const std::function<void(size_t, size_t)>& fn) {
+  if (!workers || workers->size() == 1 || n < PARALLEL_THRESHOLD) {
+    fn(0, n);
+    return;
   }
-  if (item.insert_text) {
-    return *item.insert_text;
+  // a few chunks per thread so an unlucky chunk of long texts doesn't hold
+  // the others up
+  size_t chunk = std::max(MIN_CHUNK, n / (workers->size() * 4));
+  workers->parallel_for(n, chunk, fn);
+}
+
+// checked between blocks of survivors while a ranking can be cancelled
+constexpr size_t CANCEL_BLOCK = 16384;
+
+// for_chunks, a block of CANCEL_BLOCK at a time once cancelled is given.
+// Returns false when cancelled returned true before every block ran.
+bool for_blocks(WorkerPool* workers, size_t n,
+                const std::function<bool()>& cancelled,
+                const std::function<void(size_t, size_t)>& fn) {
+  if (!cancelled) {
+    for_chunks(workers, n, fn);
+    return true;
+  }
+  for (size_t begin = 0; begin < n; begin += CANCEL_BLOCK) {
+    if (cancelled()) {
+      return false;
+    }
+    size_t end = std::min(n, begin + CANCEL_BLOCK);
+    for_chunks(workers, end - begin, [&](size_t b, size_t e) {
+      fn(begin + b, begin + e);
+    });
   }
-  return item.label;
+  return true;
 }
 
-void set_text_edit(std::vector<CompletionItem>& items, CompletionParam& param) {
-  for (auto& item : items) {
-    if (!item.text_edit.has_value()) {
-      TextEdit te;
-      te.new_text = get_text(item);
-      Position start = {param.line, param.start};
-      Position end = {param.line, param.cursor};
-      te.range = Range{start, end};
-      item.text_edit = std::optional(te);
-    } else {
-      if (item.text_edit->range) {
-        item.text_edit->range->end.character = param.cursor;
+// Scores list.survivors only, the other items are not part of the output.
+// Returns false when cancelled stopped it part way.
+bool score_items(CompletionList& list, const EditDistanceOption& option,
+                 std::string_view keyword, WorkerPool* workers,
+                 const std::function<bool()>& cancelled = nullptr) {
+  std::vector<CompletionItem>& items = list.items;
+  const std::string lower_keyword = to_lower(keyword);
+  refine_survivors(list, lower_keyword, option.index_threshold);
+  const std::vector<uint32_t>& survivors = list.survivors;
+
+  if (option.scorer == FZF) {
+    // kernel "dp" or "bit_parallel" keeps it off the simd lanes
+    SimdLevel level = option.kernel == AUTO || option.kernel == SIMD
+                          ? detect_simd_level()
+                          : SCALAR;
+    std::vector<int> scores(list.texts.size());
+    auto score = [&](size_t begin, size_t end) {
+      batch_fzf_score(list.texts, survivors.data() + begin, end - begin,
+                      lower_keyword, scores.data(), level);
+      for (size_t k = begin; k < end; ++k) {
+        uint32_t i = survivors[k];
+        items[i].cost = compute_fzf_cost(list.texts.lengths[i], scores[i],
+                                         keyword, option);
       }
-      if (item.text_edit->insert) {
-        item.text_edit->insert->end.character = param.cursor;
-      }
-      if (item.text_edit->replace) {
-        item.text_edit->replace->end.character = param.cursor;
+    };
+    return for_blocks(workers, survivors.size(), cancelled, score);
+  }
+
+  EditDistanceKernel kernel = option.settled_kernel;
+  if (kernel == AUTO) {
+    kernel = keyword.length() >= static_cast<size_t>(option.bit_parallel_length)
+                 ? BIT_PARALLEL
+                 : DP;
+  }
+
+  if (kernel == BIT_PARALLEL) {
+    BitParallelPattern pattern(std::string(keyword), option.insert_cost,
+                               option.delete_cost, option.substitude_cost,
+                               option.alpha);
+    auto score = [&](size_t begin, size_t end) {
+      for (size_t k = begin; k < end; ++k) {
+        uint32_t i = survivors[k];
+        std::string_view text = get_text(list, items[i]);
+        items[i].cost =
+            compute_cost(text, pattern.distance(text), keyword, option);
       }
-    }
+    };
+    return for_blocks(workers, survivors.size(), cancelled, score);
   }
-}
 
-int longest_common_prefix(const std::string& s1, const std::string& s2) {
-  int n = std::min(s1.length(), s2.length());
-  for (int i = 0; i < n; ++i) {
-    if (s1[i] != s2[i]) {
-      return i;
+  // the dp is the scalar loop of the same kernels
+  std::vector<int> distances(list.texts.size());
+  const SimdLevel level = kernel == SIMD ? detect_simd_level() : SCALAR;
+  auto score = [&](size_t begin, size_t end) {
+    option.batch_distance(list.texts, survivors.data() + begin, end - begin,
+                          lower_keyword, option.insert_cost,
+                          option.delete_cost, option.substitude_cost,
+                          option.alpha, distances.data(), level);
+    for (size_t k = begin; k < end; ++k) {
+      uint32_t i = survivors[k];
+      items[i].cost = compute_cost(get_text(list, items[i]), distances[i],
+                                   keyword, option);
     }
+  };
+  return for_blocks(workers, survivors.size(), cancelled, score);
+}
+
+// scales the survivor costs to [0, MAX_STARS]
+void normalize_costs(CompletionList& list, WorkerPool* workers) {
+  std::vector<CompletionItem>& items = list.items;
+  const std::vector<uint32_t>& survivors = list.survivors;
+  if (survivors.empty()) {
+    return;
   }
-  return n;
+
+  double max_cost = items[survivors[0]].cost;
+  double min_cost = items[survivors[0]].cost;
+  std::mutex mutex;
+  for_chunks(workers, survivors.size(), [&](size_t begin, size_t end) {
+    double chunk_max = items[survivors[begin]].cost;
+    double chunk_min = items[survivors[begin]].cost;
+    for (size_t k = begin; k < end; ++k) {
+      chunk_max = fmax(chunk_max, items[survivors[k]].cost);
+      chunk_min = fmin(chunk_min, items[survivors[k]].cost);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    max_cost = fmax(max_cost, chunk_max);
+    min_cost = fmin(min_cost, chunk_min);
+  });
+
+  double range = max_cost - min_cost;
+  for_chunks(workers, survivors.size(), [&](size_t begin, size_t end) {
+    for (size_t k = begin; k < end; ++k) {
+      CompletionItem& item = items[survivors[k]];
+      item.cost = range > 0 ? (item.cost - min_cost) / range * MAX_STARS : 0;
+    }
+  });
 }
 
-double compute_cost(const std::string& text, int dist,
-                    EditDistanceOption& option) {
-  if (option.keyword.length() == 0 && text.length() == 0) {
-    return std::numeric_limits<int>::max();
+// Lowers the cost of items accepted before by boost * log2(1 + score). Runs
+// before normalize_costs, so an item accepted often can pass a closer match.
+void apply_frecency(CompletionList& list, const EditDistanceOption& option,
+                    FrecencyStore& frecency, WorkerPool* workers) {
+  if (option.frecency_boost <= 0 || !frecency.sync() || frecency.size() == 0) {
+    return;
   }
-  int C = std::max(
-      {option.substitude_cost, option.insert_cost, option.delete_cost});
-  double P = longest_common_prefix(text, option.keyword);
-  double W = std::max(option.keyword.length(), text.length());
-  int L = option.keyword.length();
-  double cost = (double)dist / (W * C) - (L == 0 ? 0 : option.beta * (P / L)) +
-                (option.gamma * text.length() / W);
-  return cost;
+  const uint64_t filetype = fnv1a(option.filetype);
+  const uint32_t now = FrecencyStore::now_hours();
+  std::vector<CompletionItem>& items = list.items;
+  const std::vector<uint32_t>& survivors = list.survivors;
+  for_chunks(workers, survivors.size(), [&](size_t begin, size_t end) {
+    for (size_t k = begin; k < end; ++k) {
+      CompletionItem& item = items[survivors[k]];
+      double score =
+          frecency.score(FrecencyStore::key(filetype, item.label_hash), now);
+      if (score > 0) {
+        item.cost -= option.frecency_boost * std::log2(1 + score);
+      }
+    }
+  });
 }
 
 int lua_find_trigger_context(lua_State* L) {
@@ -663,150 +965,1533 @@ std::string Cat::get_emoji() const {
 
 static Context context;
 
+// The interned details and the rank_async copy are held for the cached lists,
+// so they count against the cache budget with them. Entries other than keep
+// are evicted while the total is over it.
+void count_shared_bytes(const CacheKey* keep = nullptr) {
+  context.completion_items.set_shared_bytes(
+      context.interned.bytes() + context.snapshot.bytes, keep);
+}
+
+// Lets go of the list rank_async copied. A ranking scoring it right now drops
+// it itself once it sees cleared moved on.
+void release_snapshot() {
+  context.cleared++;
+  if (!context.ranking) {
+    context.snapshot = RankSnapshot();
+  }
+}
+
 int lua_clear_items(lua_State*) {
+  std::lock_guard<std::mutex> lock(context.mutex);
+  release_snapshot();
   context.completion_items.clear();
+  context.ranked_key.reset();
+  context.interned.clear();
+  count_shared_bytes();
+  context.responses.clear();
+  context.results.clear();
   return 0;
 }
 
+// the list cached at key, created empty when there is none
+CompletionList& get_list(const CacheKey& key) {
+  CompletionList& list = context.completion_items.get(key);
+  if (list.generation == 0) {
+    list.generation = ++context.generation;
+  }
+  return list;
+}
+
+int client_priority(int client_id) {
+  auto it = context.client_priority.find(client_id);
+  return it != context.client_priority.end() ? it->second : 0;
+}
+
+// Appends an item of client_id to list. Returns false when it was merged
+// into an item with the same lowercased text and kind from another client
+// instead, which keeps the item of the client with the higher priority.
+bool append_item(CompletionList& list, CompletionItem&& item, int client_id) {
+  item.client_id = client_id;
+  item.label_hash = fnv1a(list.strings.get(item.label));
+  list.texts.push_back(get_text(list, item));
+  uint32_t index = list.items.size();
+  std::string_view text = list.texts.text(index);
+  auto [it, inserted] = list.dedup.try_emplace(
+      absl::HashOf(text, static_cast<int>(item.kind.value_or(Text))), index);
+  if (!inserted) {
+    CompletionItem& first = list.items[it->second];
+    // a client may send overloads with the same text, and a hash collision
+    // is kept as a separate item
+    if (first.client_id != client_id && first.kind == item.kind &&
+        list.texts.text(it->second) == text) {
+      list.texts.pop_back();
+      if (client_priority(client_id) > client_priority(first.client_id)) {
+        first = std::move(item);
+      }
+      return false;
+    }
+  }
+  list.items.push_back(std::move(item));
+  return true;
+}
+
+// Removes the items of client_id from list. Lazy results of the list read
+// as nil afterwards, as their indices moved.
+void remove_items_of(CompletionList& list, int client_id) {
+  auto of_client = [client_id](const CompletionItem& item) {
+    return item.client_id == client_id;
+  };
+  if (std::none_of(list.items.begin(), list.items.end(), of_client)) {
+    return;
+  }
+  std::vector<CompletionItem> items;
+  items.swap(list.items);
+  list.texts.clear();
+  list.dedup.clear();
+  for (CompletionItem& item : items) {
+    if (!of_client(item)) {
+      append_item(list, std::move(item), item.client_id);
+    }
+  }
+  list.generation = ++context.generation;
+}
+
+std::optional<std::string_view> optional_string(const CompletionList& list,
+                                                StringRef ref) {
+  if (!ref.has_value()) {
+    return std::nullopt;
+  }
+  return list.strings.get(ref);
+}
+
+// writes the items inserted at key to the session being recorded
+void record_insert(const CacheKey& key, int client_id,
+                   const CompletionList& list,
+                   const std::vector<CompletionItem>& items) {
+  SessionInsert insert{client_id, key.bufnr, key.line, key.col, {}};
+  insert.items.reserve(items.size());
+  for (const CompletionItem& item : items) {
+    SessionItem& recorded = insert.items.emplace_back();
+    recorded.label = list.strings.get(item.label);
+    recorded.filter_text = optional_string(list, item.filter_text);
+    recorded.sort_text = optional_string(list, item.sort_text);
+    recorded.insert_text = optional_string(list, item.insert_text);
+    if (item.detail != InternPool::NONE) {
+      recorded.detail = context.interned.get(item.detail);
+    }
+    if (item.kind) {
+      recorded.kind = *item.kind;
+    }
+    recorded.insert_text_format = item.insert_text_format;
+    if (item.text_edit) {
+      SessionEdit& edit = recorded.text_edit.emplace();
+      edit.new_text = list.strings.get(item.text_edit->new_text);
+      edit.ranges = item.text_edit->ranges;
+      uint32_t next = item.text_edit->first_range;
+      const TextEditRange bits[] = {RANGE, INSERT, REPLACE};
+      for (int r = 0; r < 3; ++r) {
+        if (edit.ranges & bits[r]) {
+          const Range& range = list.ranges[next++];
+          edit.coords[r][0] = range.start.line;
+          edit.coords[r][1] = range.start.character;
+          edit.coords[r][2] = range.end.line;
+          edit.coords[r][3] = range.end.character;
+        }
+      }
+    }
+  }
+  context.recorder.insert(insert);
+}
+
+void record_query(const CacheKey& key, const WordRange& word,
+                  const EditDistanceOption& option, std::string_view keyword) {
+  context.recorder.query(SessionQuery{
+      key.bufnr, key.line, key.col, word.start, word.cursor, keyword,
+      option.insert_cost, option.delete_cost, option.substitude_cost,
+      option.alpha, option.max_cost, option.beta, option.gamma,
+      static_cast<uint8_t>(option.kernel), option.max_results, option.lazy,
+      option.index_threshold, option.filetype, option.frecency_boost,
+      static_cast<uint8_t>(option.scorer)});
+}
+
+// call once after a run of append_item, the next ranking starts over
+void items_added(const CacheKey& key, CompletionList& list) {
+  list.texts.sort_by_length();
+  list.index.clear();
+  list.refinable = false;
+  list.ranked.clear();
+  list.ranked_sorted = 0;
+  list.ranking++;
+  list.revision++;
+  count_shared_bytes(&key);
+  context.completion_items.set_bytes(key, list.bytes());
+}
+
+using Clock = Tracer::Clock;
+
+// Ends the stage that began at start at now, records it in histogram and as
+// a span of the tracer. start moves on to now for the next stage.
+void end_stage(Histogram& histogram, const char* name,
+               Clock::time_point& start, int bufnr, int client_id,
+               int64_t items, Clock::time_point now = Clock::now()) {
+  histogram.record(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(now - start)
+          .count());
+  context.tracer.span(name, start, now, bufnr, client_id, items);
+  start = now;
+}
+
+// Rewrites the columns of list.ranges from first on that lie on line, counted
+// in encoding, to bytes.
+void convert_ranges(CompletionList& list, size_t first, int line,
+                    const LineColumns& columns, PositionEncoding encoding) {
+  for (size_t i = first; i < list.ranges.size(); ++i) {
+    for (Position* p : {&list.ranges[i].start, &list.ranges[i].end}) {
+      if (p->line == line) {
+        p->character =
+            columns.convert(p->character, encoding, PositionEncoding::UTF8);
+      }
+    }
+  }
+}
+
 /**
  * param1: list of items
  * param2: client_id
  * param3: bufnr
  * param4: line (1-indexed)
  * param5: col (1-indexed)
+ * param6: response (optional), { word_start = 1-indexed start of the word,
+ *         word = word typed at the request, is_incomplete = boolean,
+ *         line_text = the line at the request (optional), encoding =
+ *         position encoding of the client (optional, "utf-16" default) }
+ * param7: chunk (optional), { offset = 1-indexed item to start at,
+ *         max_items = items to parse, max_us = microseconds to parse for }
+ *
+ * Text edit ranges on the line are rewritten from the position encoding of
+ * the client to the byte columns nvim counts, once line_text is given.
+ *
+ * Without a chunk every item is inserted and nil is returned. With one, the
+ * items from offset on are parsed until either limit is hit and the offset to
+ * continue from is returned, or nil once the last item is in. The items
+ * inserted so far rank like a complete list in the meantime, the response is
+ * only recorded for refiltering with the last chunk.
+ *
+ * An item with the same lowercased text and kind as one another client put
+ * in the list is merged into it, keeping the item of the client with the
+ * higher priority. The number merged by this call is returned second.
  */
 int lua_insert_items(lua_State* L) {
-  std::lock_guard<std::mutex> lock(context.mutex);
-
   luaL_checktype(L, 1, LUA_TTABLE);
-  lua_pushvalue(L, 1);
-  std::vector<CompletionItem> items = parse_completion_items(L);
-  lua_pop(L, 1);
-
   int client_id = luaL_checkint(L, 2);
   int bufnr = luaL_checkint(L, 3);
   int line = luaL_checkint(L, 4);
   int col = luaL_checkint(L, 5);
   CacheKey key{bufnr, line, col};
 
-  std::vector<CompletionItem>& completion_items = context.completion_items.get(key);
-  for (auto& item : items) {
-    item.client_id = client_id;
-    completion_items.push_back(std::move(item));
+  std::optional<std::pair<WordKey, WordResponse>> response;
+  std::optional<LineColumns> columns;
+  PositionEncoding encoding = PositionEncoding::UTF8;
+  if (lua_istable(L, 6)) {
+    lua_pushvalue(L, 6);
+    lua_getfield(L, -1, "word_start");
+    int word_start = luaL_checkinteger(L, -1);
+    lua_pop(L, 1);
+    auto word = get_optional_string(L, "word");
+    lua_getfield(L, -1, "is_incomplete");
+    bool incomplete = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    encoding = parse_position_encoding(
+        get_optional_string(L, "encoding").value_or(""));
+    lua_getfield(L, -1, "line_text");
+    size_t length;
+    const char* line_text = lua_tolstring(L, -1, &length);
+    if (line_text && encoding != PositionEncoding::UTF8) {
+      columns.emplace(std::string_view(line_text, length));
+    }
+    lua_pop(L, 2);
+    response = {WordKey{bufnr, line, word_start, client_id},
+                WordResponse{col, word ? *word : "", incomplete}};
   }
-  return 0;
-}
-
-int lua_interact(lua_State*) {
-  std::lock_guard<std::mutex> lock(context.mutex);
-  context.cat.Interact();
-  return 0;
-}
-
-int lua_cat_emoji(lua_State* L) {
-  std::string emoji = context.cat.get_emoji();
-  lua_pushstring(L, emoji.c_str());
-  return 1;
-}
-
-/**
- * param1: bufnr
- * param2: line (1-indexed)
- * param3: col (1-indexed)
- * param4: start (1-indexed)
- * param5: edit distance option
- */
-int lua_get_completion_items(lua_State* L) {
-  int bufnr = luaL_checkinteger(L, 1);
-  int line = luaL_checkinteger(L, 2);
-  int col = luaL_checkinteger(L, 3);
-  int start = luaL_checkinteger(L, 4);
-  luaL_checktype(L, 5, LUA_TTABLE);
 
-  CacheKey key{bufnr, line, col};
-
-  lua_pushvalue(L, 5);
-  EditDistanceOption option = parse_edit_distance_option(L);
-  lua_pop(L, 1);
-
-  std::vector<CompletionItem>& items = context.completion_items.get(key);
-
-  for (auto& item : items) {
-    std::string& text = get_text(item);
-    auto [dist, is_subseq] = edit_distance(text, option);
-    item.cost = compute_cost(text, dist, option);
-    item.is_subseq = is_subseq;
+  bool chunked = lua_istable(L, 7);
+  size_t offset = 1;
+  int max_items = 0;
+  int max_us = 0;
+  if (chunked) {
+    lua_pushvalue(L, 7);
+    offset = std::max(1, get_optional_int(L, "offset").value_or(1));
+    max_items = get_optional_int(L, "max_items").value_or(0);
+    max_us = get_optional_int(L, "max_us").value_or(0);
+    lua_pop(L, 1);
   }
 
-  if (!items.empty()) {
-    double max_cost = items[0].cost;
-    double min_cost = items[0].cost;
-    for (size_t i = 1; i < items.size(); ++i) {
-      max_cost = fmax(max_cost, items[i].cost);
-      min_cost = fmin(min_cost, items[i].cost);
+  Clock::time_point start = Clock::now();
+  ParsedItems batch;
+  size_t next = 0;
+  size_t parsed = 0;
+  if (!chunked) {
+    lua_pushvalue(L, 1);
+    batch.items = parse_completion_items(L, batch.list, batch.details);
+    lua_pop(L, 1);
+    parsed = batch.items.size();
+  } else {
+    const auto deadline = start + std::chrono::microseconds(max_us);
+    const size_t n = lua_objlen(L, 1);
+    for (next = offset; next <= n; ++next) {
+      if (max_items > 0 && parsed >= (size_t)max_items) {
+        break;
+      }
+      // reading the clock costs about as much as a small item
+      if (max_us > 0 && parsed > 0 && parsed % 32 == 0 &&
+          Clock::now() >= deadline) {
+        break;
+      }
+      lua_rawgeti(L, 1, next);
+      if (lua_istable(L, -1)) {
+        batch.items.push_back(
+            parse_completion_item(L, batch.list, batch.details));
+      }
+      lua_pop(L, 1);
+      parsed++;
     }
-    double range = max_cost - min_cost;
-    for (size_t i = 0; i < items.size(); ++i) {
-      items[i].cost = (items[i].cost - min_cost) / range * MAX_STARS;
+    if (next > n) {
+      next = 0;
     }
   }
 
-  std::vector<CompletionItem> output;
-  for (auto& item : items) {
-    if (item.is_subseq) {
-      output.push_back(item);
+  std::lock_guard<std::mutex> lock(context.mutex);
+  CompletionList& list = get_list(key);
+  // the live response replaces what the last session left
+  if (client_id != BUFFER_WORDS_CLIENT && client_id != RESPONSE_CACHE_CLIENT) {
+    context.live_buffers.insert(bufnr);
+    remove_items_of(list, RESPONSE_CACHE_CLIENT);
+  }
+  const size_t first_range = list.ranges.size();
+  move_parsed(batch, list, context.interned);
+  const bool recording = context.recorder.is_open();
+  std::vector<CompletionItem> recorded;
+  if (recording) {
+    recorded = batch.items;
+  }
+  size_t merged = 0;
+  list.items.reserve(list.items.size() + batch.items.size());
+  for (CompletionItem& item : batch.items) {
+    if (!append_item(list, std::move(item), client_id)) {
+      merged++;
     }
   }
 
-  for (auto& item : output) {
-    if (!item.text_edit.has_value()) {
-      TextEdit te;
-      te.new_text = get_text(item);
-      Position s = {line-1, start-1};
-      Position e = {line-1, col};
-      te.range = Range{s, e};
-      item.text_edit = std::optional(te);
-    } else {
-      if (item.text_edit->range) {
-        item.text_edit->range->end.character = col;
-      }
-      if (item.text_edit->insert) {
-        item.text_edit->insert->end.character = col;
-      }
-      if (item.text_edit->replace) {
-        item.text_edit->replace->end.character = col;
-      }
-    }
+  // an ascii line counts the same in every encoding
+  if (columns && !columns->ascii()) {
+    convert_ranges(list, first_range, line - 1, *columns, encoding);
+  }
+  items_added(key, list);
+  end_stage(context.stats.parse, "insert_items", start, bufnr, client_id,
+            parsed);
+  if (recording) {
+    record_insert(key, client_id, list, recorded);
   }
+  context.stats.inserted.record(parsed);
 
-  std::sort(output.begin(), output.end(), CompareCompletionItem());
+  // a partial list must not be refiltered as if it were the whole response
+  if (response && next == 0) {
+    context.responses[response->first] = response->second;
+  }
+
+  context.duplicates += merged;
+
+  if (next > 0) {
+    lua_pushinteger(L, next);
+  } else {
+    lua_pushnil(L);
+  }
+  lua_pushinteger(L, merged);
+  return 2;
+}
+
+/**
+ * param1: client_id
+ * param2: bufnr
+ * param3: line (1-indexed)
+ * param4: word_start (1-indexed)
+ * param5: word typed so far
+ *
+ * Returns the col the client's items for this word are cached at when they
+ * can be filtered again instead of asking the server, nil otherwise. That
+ * holds while the response was complete, is still cached and the word only
+ * grew since the request.
+ */
+int lua_can_refilter(lua_State* L) {
+  int client_id = luaL_checkint(L, 1);
+  int bufnr = luaL_checkint(L, 2);
+  int line = luaL_checkint(L, 3);
+  int word_start = luaL_checkint(L, 4);
+  size_t length = 0;
+  const char* s = luaL_checklstring(L, 5, &length);
+  std::string_view word(s, length);
 
-  push_completion_items(L, output);
+  std::lock_guard<std::mutex> lock(context.mutex);
+  auto it = context.responses.find(WordKey{bufnr, line, word_start, client_id});
+  if (it == context.responses.end()) {
+    lua_pushnil(L);
+    return 1;
+  }
+  const WordResponse& response = it->second;
+  bool extends = word.substr(0, response.word.length()) == response.word;
+  if (response.incomplete || !extends ||
+      !context.completion_items.has_value(CacheKey{bufnr, line, response.col})) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_pushinteger(L, response.col);
   return 1;
 }
 
 /**
  * param1: bufnr
- * param2: line (1-indexed)
- * param3: col (1-indexed)
+ * param2: first line (0-indexed)
+ * param3: last line (0-indexed, exclusive), negative for the last line held
+ * param4: list of lines replacing [first, last)
+ *
+ * Feeds the buffer word index from nvim_buf_attach on_lines, only the lines
+ * passed are tokenized.
  */
-int lua_has_cache(lua_State* L) {
-  int bufnr = luaL_checkinteger(L, 1);
-  int line = luaL_checkinteger(L, 2);
-  int col = luaL_checkinteger(L, 3);
-
-  CacheKey key{bufnr, line, col};
+int lua_set_buffer_lines(lua_State* L) {
+  int bufnr = luaL_checkint(L, 1);
+  int first = luaL_checkint(L, 2);
+  int last = luaL_checkint(L, 3);
+  luaL_checktype(L, 4, LUA_TTABLE);
+
+  // the views point into the strings of the table, which outlives the call
+  const size_t n = lua_objlen(L, 4);
+  std::vector<std::string_view> lines;
+  lines.reserve(n);
+  for (size_t i = 1; i <= n; ++i) {
+    lua_rawgeti(L, 4, i);
+    size_t length = 0;
+    const char* s = lua_tolstring(L, -1, &length);
+    lines.emplace_back(s ? s : "", length);
+    lua_pop(L, 1);
+  }
 
-  bool has_value = context.completion_items.has_value(key);
-  lua_pushboolean(L, has_value);
-  return 1;
+  std::lock_guard<std::mutex> lock(context.mutex);
+  BufferWords& words = context.buffer_words[bufnr];
+  words.set_lines(std::max(first, 0),
+                  last < 0 ? words.line_count() : static_cast<size_t>(last),
+                  lines);
+  return 0;
+}
+
+/**
+ * param1: bufnr
+ */
+int lua_clear_buffer_words(lua_State* L) {
+  int bufnr = luaL_checkint(L, 1);
+  std::lock_guard<std::mutex> lock(context.mutex);
+  context.buffer_words.erase(bufnr);
+  return 0;
+}
+
+/**
+ * param1: bufnr
+ * param2: line (1-indexed)
+ * param3: col (1-indexed)
+ * param4: word typed so far
+ *
+ * Adds the words of the buffer containing word as a subsequence to the list
+ * cached at line and col, as Text items of BUFFER_WORDS_CLIENT. They rank
+ * with the items of the language servers. The word being typed only counts
+ * when it also appears elsewhere. Returns the number of words added.
+ */
+int lua_insert_buffer_words(lua_State* L) {
+  int bufnr = luaL_checkint(L, 1);
+  int line = luaL_checkint(L, 2);
+  int col = luaL_checkint(L, 3);
+  size_t length = 0;
+  const char* s = luaL_checklstring(L, 4, &length);
+  std::string_view typed(s, length);
+  std::string lower_typed = to_lower(typed);
+  const uint64_t typed_mask = char_mask(lower_typed);
+  CacheKey key{bufnr, line, col};
+
+  std::lock_guard<std::mutex> lock(context.mutex);
+  auto it = context.buffer_words.find(bufnr);
+  if (it == context.buffer_words.end()) {
+    lua_pushinteger(L, 0);
+    return 1;
+  }
+
+  CompletionList& list = get_list(key);
+  size_t added = 0;
+  std::vector<CompletionItem> recorded;
+  for (const auto& [word, folded] : it->second.words()) {
+    // most words miss some character of the typed word
+    if ((folded.mask & typed_mask) != typed_mask ||
+        (word == typed && folded.count == 1) ||
+        !is_subsequence(folded.lower, lower_typed)) {
+      continue;
+    }
+    CompletionItem item;
+    item.label = list.strings.add(word);
+    item.kind = Text;
+    if (context.recorder.is_open()) {
+      recorded.push_back(item);
+    }
+    if (append_item(list, std::move(item), BUFFER_WORDS_CLIENT)) {
+      added++;
+    }
+  }
+  items_added(key, list);
+  if (!recorded.empty()) {
+    record_insert(key, BUFFER_WORDS_CLIENT, list, recorded);
+  }
+  lua_pushinteger(L, added);
+  return 1;
+}
+
+/**
+ * param1: path of the store, created when missing
+ * param2: half life of a score in hours (optional)
+ *
+ * Returns true, or nil and a message when the file cannot be mapped.
+ */
+int lua_open_frecency(lua_State* L) {
+  std::string path = luaL_checkstring(L, 1);
+  double half_life = luaL_optnumber(L, 2, 24 * 14);
+  std::lock_guard<std::mutex> lock(context.mutex);
+  if (!context.frecency.open(path, half_life)) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(errno));
+    return 2;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+/**
+ * param1: filetype
+ * param2: label of the accepted item
+ */
+int lua_record_selection(lua_State* L) {
+  size_t length = 0;
+  const char* filetype = luaL_checklstring(L, 1, &length);
+  uint64_t filetype_hash = fnv1a(std::string_view(filetype, length));
+  const char* label = luaL_checklstring(L, 2, &length);
+  uint64_t label_hash = fnv1a(trim_view(std::string_view(label, length)));
+  std::lock_guard<std::mutex> lock(context.mutex);
+  context.frecency.record(FrecencyStore::key(filetype_hash, label_hash));
+  return 0;
+}
+
+/**
+ * param1: path of the cache file
+ *
+ * Maps the responses saved by the last session, returns whether there were
+ * any.
+ */
+int lua_load_response_cache(lua_State* L) {
+  std::string path = luaL_checkstring(L, 1);
+  std::lock_guard<std::mutex> lock(context.mutex);
+  lua_pushboolean(L, context.saved_responses.load(path));
+  return 1;
+}
+
+/**
+ * param1: path of the cache file
+ * param2: table of bufnr to the file path of the buffer
+ *
+ * Saves the cached items of those buffers by file path, the most used lists
+ * first, up to MAX_SAVED_ITEMS per file. Files saved last session and not
+ * completed in this one are kept, up to MAX_SAVED_FILES in all. Text edits
+ * and buffer words are left out. Returns whether the file was written.
+ */
+int lua_save_response_cache(lua_State* L) {
+  std::string path = luaL_checkstring(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  absl::flat_hash_map<int, std::string> buffers;
+  lua_pushnil(L);
+  while (lua_next(L, 2) != 0) {
+    if (lua_isnumber(L, -2) && lua_isstring(L, -1)) {
+      buffers[lua_tointeger(L, -2)] = lua_tostring(L, -1);
+    }
+    lua_pop(L, 1);
+  }
+
+  std::lock_guard<std::mutex> lock(context.mutex);
+  std::vector<SavedFile> files;
+  absl::flat_hash_map<std::string, size_t> file_index;
+  // label and kind of the items saved per file
+  std::vector<absl::flat_hash_set<std::pair<std::string, int>>> saved;
+  auto file_of = [&](const std::string& file_path) {
+    auto [it, inserted] = file_index.try_emplace(file_path, files.size());
+    if (inserted) {
+      files.push_back(SavedFile{file_path, {}});
+      saved.emplace_back();
+    }
+    return it->second;
+  };
+
+  context.completion_items.for_each(
+      [&](const CacheKey& key, const CompletionList& list) {
+        auto buffer = buffers.find(key.bufnr);
+        if (buffer == buffers.end() || buffer->second.empty()) {
+          return;
+        }
+        size_t f = file_of(buffer->second);
+        for (const CompletionItem& item : list.items) {
+          if (files[f].items.size() >= MAX_SAVED_ITEMS) {
+            break;
+          }
+          if (item.client_id == BUFFER_WORDS_CLIENT ||
+              item.client_id == RESPONSE_CACHE_CLIENT) {
+            continue;
+          }
+          std::string label(list.strings.get(item.label));
+          int kind = item.kind.value_or(static_cast<CompletionItemKind>(0));
+          if (!saved[f].emplace(label, kind).second) {
+            continue;
+          }
+          files[f].items.push_back(SavedItem{
+              std::move(label),
+              std::string(list.strings.get(item.filter_text)),
+              std::string(list.strings.get(item.insert_text)),
+              std::string(list.strings.get(item.sort_text)),
+              item.detail != InternPool::NONE
+                  ? context.interned.get(item.detail)
+                  : std::string(),
+              static_cast<uint8_t>(kind),
+              static_cast<uint8_t>(item.insert_text_format.value_or(0)),
+          });
+        }
+      });
+
+  for (std::string_view file_path : context.saved_responses.paths()) {
+    if (file_index.size() >= MAX_SAVED_FILES) {
+      break;
+    }
+    std::string saved_path(file_path);
+    if (file_index.count(saved_path)) {
+      continue;
+    }
+    size_t f = file_of(saved_path);
+    context.saved_responses.for_each_item(
+        file_path, [&](const ResponseCache::ItemView& item) {
+          files[f].items.push_back(SavedItem{
+              std::string(item.label), std::string(item.filter_text),
+              std::string(item.insert_text), std::string(item.sort_text),
+              std::string(item.detail), item.kind, item.insert_text_format});
+        });
+  }
+
+  files.erase(std::remove_if(files.begin(), files.end(),
+                             [](const SavedFile& file) {
+                               return file.items.empty();
+                             }),
+              files.end());
+  if (files.size() > MAX_SAVED_FILES) {
+    files.resize(MAX_SAVED_FILES);
+  }
+  lua_pushboolean(L, ResponseCache::save(path, files));
+  return 1;
+}
+
+/**
+ * param1: bufnr
+ * param2: file path of the buffer
+ * param3: line (1-indexed)
+ * param4: col (1-indexed)
+ * param5: word typed so far
+ *
+ * Adds the items saved for the file last session that contain word as a
+ * subsequence to the list cached at line and col, until a server responds
+ * for the buffer. The first response into that list replaces them. Returns
+ * the number of items added.
+ */
+int lua_insert_saved_items(lua_State* L) {
+  int bufnr = luaL_checkint(L, 1);
+  size_t length = 0;
+  const char* s = luaL_checklstring(L, 2, &length);
+  std::string_view file_path(s, length);
+  int line = luaL_checkint(L, 3);
+  int col = luaL_checkint(L, 4);
+  s = luaL_checklstring(L, 5, &length);
+  std::string lower_typed = to_lower(std::string_view(s, length));
+  const uint64_t typed_mask = char_mask(lower_typed);
+  CacheKey key{bufnr, line, col};
+
+  std::lock_guard<std::mutex> lock(context.mutex);
+  if (context.live_buffers.count(bufnr)) {
+    lua_pushinteger(L, 0);
+    return 1;
+  }
+
+  CompletionList* list = nullptr;
+  size_t added = 0;
+  std::vector<CompletionItem> recorded;
+  context.saved_responses.for_each_item(
+      file_path, [&](const ResponseCache::ItemView& saved) {
+        std::string_view text = !saved.filter_text.empty() ? saved.filter_text
+                                : !saved.insert_text.empty()
+                                    ? saved.insert_text
+                                    : saved.label;
+        std::string lower = to_lower(text);
+        if ((char_mask(lower) & typed_mask) != typed_mask ||
+            !is_subsequence(lower, lower_typed)) {
+          return;
+        }
+        if (!list) {
+          list = &get_list(key);
+        }
+        CompletionItem item;
+        item.label = list->strings.add(saved.label);
+        if (!saved.filter_text.empty()) {
+          item.filter_text = list->strings.add(saved.filter_text);
+        }
+        if (!saved.insert_text.empty()) {
+          item.insert_text = list->strings.add(saved.insert_text);
+        }
+        if (!saved.sort_text.empty()) {
+          item.sort_text = list->strings.add(saved.sort_text);
+        }
+        if (!saved.detail.empty()) {
+          item.detail = context.interned.intern(saved.detail);
+        }
+        if (saved.kind != 0) {
+          item.kind = static_cast<CompletionItemKind>(saved.kind);
+        }
+        if (saved.insert_text_format != 0) {
+          item.insert_text_format = saved.insert_text_format;
+        }
+        if (context.recorder.is_open()) {
+          recorded.push_back(item);
+        }
+        if (append_item(*list, std::move(item), RESPONSE_CACHE_CLIENT)) {
+          added++;
+        }
+      });
+  if (list) {
+    items_added(key, *list);
+  }
+  if (!recorded.empty()) {
+    record_insert(key, RESPONSE_CACHE_CLIENT, *list, recorded);
+  }
+  lua_pushinteger(L, added);
+  return 1;
+}
+
+int lua_interact(lua_State*) {
+  std::lock_guard<std::mutex> lock(context.mutex);
+  context.cat.Interact();
+  return 0;
+}
+
+int lua_cat_emoji(lua_State* L) {
+  std::string emoji = context.cat.get_emoji();
+  lua_pushstring(L, emoji.c_str());
+  return 1;
+}
+
+// Sorts list.ranked far enough for its first count items to be final. The
+// sorted prefix only grows, so paging further down sorts just the next part.
+void rank_items(CompletionList& list, size_t count) {
+  std::vector<uint32_t>& ranked = list.ranked;
+  count = std::min(count, ranked.size());
+  if (count <= list.ranked_sorted) {
+    return;
+  }
+  std::partial_sort(ranked.begin() + list.ranked_sorted,
+                    ranked.begin() + count, ranked.end(),
+                    CompareCompletionItem{list});
+  list.ranked_sorted = count;
+}
+
+#define COMPLETION_RESULT "paw.CompletionResult"
+#define COMPLETION_ITEM "paw.CompletionItem"
+#define SCORING_PROFILE "paw.ScoringProfile"
+
+const CompletionList* find_list(const CacheKey& key, uint64_t generation) {
+  const CompletionList* list = context.completion_items.find(key);
+  if (!list || list->generation != generation) {
+    return nullptr;
+  }
+  return list;
+}
+
+void push_lazy_items(lua_State* L, const CompletionList& list, size_t offset,
+                     size_t end, const CacheKey& key, const WordRange& word) {
+  void* p = lua_newuserdata(L, sizeof(CompletionResult));
+  CompletionResult* result =
+      new (p) CompletionResult{key, list.generation, word, {}, {}};
+  luaL_getmetatable(L, COMPLETION_RESULT);
+  lua_setmetatable(L, -2);
+
+  for (size_t i = offset; i < end; ++i) {
+    result->indices.push_back(list.ranked[i]);
+    result->costs.push_back(list.items[list.ranked[i]].cost);
+  }
+}
+
+int lua_completion_result_gc(lua_State* L) {
+  auto* result = static_cast<CompletionResult*>(
+      luaL_checkudata(L, 1, COMPLETION_RESULT));
+  result->~CompletionResult();
+  return 0;
+}
+
+int lua_completion_result_len(lua_State* L) {
+  auto* result = static_cast<CompletionResult*>(
+      luaL_checkudata(L, 1, COMPLETION_RESULT));
+  lua_pushinteger(L, result->indices.size());
+  return 1;
+}
+
+/**
+ * param1: completion result
+ * param2: index (1-indexed)
+ */
+int lua_completion_result_index(lua_State* L) {
+  auto* result = static_cast<CompletionResult*>(
+      luaL_checkudata(L, 1, COMPLETION_RESULT));
+  int i = lua_isnumber(L, 2) ? lua_tointeger(L, 2) : 0;
+  std::lock_guard<std::mutex> lock(context.mutex);
+  if (i < 1 || i > (int)result->indices.size() ||
+      !find_list(result->key, result->generation)) {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  void* p = lua_newuserdata(L, sizeof(CompletionItemHandle));
+  new (p) CompletionItemHandle{result->key, result->generation, result->word,
+                               result->indices[i - 1], result->costs[i - 1]};
+  luaL_getmetatable(L, COMPLETION_ITEM);
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+/**
+ * param1: completion item
+ * param2: field
+ */
+int lua_completion_item_index(lua_State* L) {
+  auto* handle = static_cast<CompletionItemHandle*>(
+      luaL_checkudata(L, 1, COMPLETION_ITEM));
+  const char* field = lua_tostring(L, 2);
+  std::lock_guard<std::mutex> lock(context.mutex);
+  const CompletionList* list = find_list(handle->key, handle->generation);
+  if (!field || !list) {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  const CompletionItem& item = list->items[handle->index];
+  std::string_view name = field;
+  if (name == "label") {
+    push_lstring(L, list->strings.get(item.label));
+  } else if (name == "kind" && item.kind) {
+    lua_pushinteger(L, *item.kind);
+  } else if (name == "detail" && item.detail != InternPool::NONE) {
+    push_lstring(L, context.interned.get(item.detail));
+  } else if (name == "sortText" && item.sort_text.has_value()) {
+    push_lstring(L, list->strings.get(item.sort_text));
+  } else if (name == "filterText" && item.filter_text.has_value()) {
+    push_lstring(L, list->strings.get(item.filter_text));
+  } else if (name == "insertText" && item.insert_text.has_value()) {
+    push_lstring(L, list->strings.get(item.insert_text));
+  } else if (name == "insertTextFormat" && item.insert_text_format) {
+    lua_pushinteger(L, *item.insert_text_format);
+  } else if (name == "textEdit") {
+    push_text_edit(L, *list, item, handle->word);
+  } else if (name == "clientId") {
+    lua_pushnumber(L, item.client_id);
+  } else if (name == "cost") {
+    lua_pushnumber(L, handle->cost);
+  } else {
+    lua_pushnil(L);
+  }
+  return 1;
+}
+
+void push_ranked_items(lua_State* L, CompletionList& list, size_t offset,
+                       size_t count, const CacheKey& key,
+                       const WordRange& word, bool lazy) {
+  Clock::time_point start = Clock::now();
+  size_t end = std::min(list.ranked_sorted, offset + count);
+  if (lazy) {
+    push_lazy_items(L, list, std::min(offset, end), end, key, word);
+  } else {
+    lua_newtable(L);
+    int index = 1;
+    for (size_t i = offset; i < end; ++i) {
+      push_completion_item(L, list, list.items[list.ranked[i]],
+                           context.interned, word);
+      lua_rawseti(L, -2, index++);
+    }
+  }
+  end_stage(context.stats.marshal, "marshal", start, key.bufnr, Tracer::NONE,
+            end - std::min(offset, end));
+}
+
+/**
+ * param1: edit distance option, its keyword is ignored
+ *
+ * returns a profile get_completion_items and rank_async take in place of the
+ * option, with the keyword passed on its own
+ */
+int lua_create_profile(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_pushvalue(L, 1);
+  EditDistanceOption option = parse_edit_distance_option(L);
+  // parse_edit_distance_option falls back on the defaults for these
+  auto kernel = get_optional_string(L, "kernel");
+  auto scorer = get_optional_string(L, "scorer");
+  lua_pop(L, 1);
+  if (kernel && option.kernel == AUTO && *kernel != "auto") {
+    return luaL_error(L, "unknown kernel %s", kernel->c_str());
+  }
+  if (scorer && option.scorer == LEVENSHTEIN && *scorer != "levenshtein") {
+    return luaL_error(L, "unknown scorer %s", scorer->c_str());
+  }
+  if (option.insert_cost < 0 || option.delete_cost < 0 ||
+      option.substitude_cost < 0) {
+    return luaL_error(L, "edit costs cannot be negative");
+  }
+  // compute_cost divides by the largest cost
+  if (option.scorer == LEVENSHTEIN &&
+      std::max({option.insert_cost, option.delete_cost,
+                option.substitude_cost}) == 0) {
+    return luaL_error(L, "edit costs cannot all be 0");
+  }
+  option.keyword.clear();
+
+  void* p = lua_newuserdata(L, sizeof(ScoringProfile));
+  new (p) ScoringProfile{std::move(option)};
+  luaL_getmetatable(L, SCORING_PROFILE);
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+int lua_scoring_profile_gc(lua_State* L) {
+  auto* profile =
+      static_cast<ScoringProfile*>(luaL_checkudata(L, 1, SCORING_PROFILE));
+  profile->~ScoringProfile();
+  return 0;
+}
+
+// The option at index, a profile of create_profile or a table parsed into
+// parsed. keyword is the string at keyword_index for a profile, the keyword
+// of the table otherwise, and stays valid while the Lua call runs.
+const EditDistanceOption& get_option(lua_State* L, int index,
+                                     int keyword_index,
+                                     EditDistanceOption& parsed,
+                                     std::string_view& keyword) {
+  if (lua_isuserdata(L, index)) {
+    const auto* profile = static_cast<const ScoringProfile*>(
+        luaL_checkudata(L, index, SCORING_PROFILE));
+    size_t length;
+    const char* s = luaL_checklstring(L, keyword_index, &length);
+    keyword = std::string_view(s, length);
+    return profile->option;
+  }
+  luaL_checktype(L, index, LUA_TTABLE);
+  lua_pushvalue(L, index);
+  parsed = parse_edit_distance_option(L);
+  lua_pop(L, 1);
+  keyword = parsed.keyword;
+  return parsed;
+}
+
+// Lets go of lock for its scope, when there is one.
+class Unlocked {
+ public:
+  explicit Unlocked(std::unique_lock<std::mutex>* lock) : lock_(lock) {
+    if (lock_) {
+      lock_->unlock();
+    }
+  }
+  ~Unlocked() {
+    if (lock_) {
+      lock_->lock();
+    }
+  }
+
+ private:
+  std::unique_lock<std::mutex>* lock_;
+};
+
+// Scores list for keyword with option and ranks its survivors far enough
+// for the first page. Returns the size of that page, or 0 when cancelled
+// stopped the scoring. With a lock, list is a copy only the caller holds: the
+// lock is let go while it is scored, normalized and sorted, and held for the
+// frecency store and the stats.
+size_t rank_list(CompletionList& list, const EditDistanceOption& option,
+                 std::string_view keyword, WorkerPool* workers,
+                 std::unique_lock<std::mutex>* lock,
+                 const std::function<bool()>& cancelled) {
+  Stats& stats = context.stats;
+  Clock::time_point start = Clock::now();
+  bool scored;
+  {
+    Unlocked unlocked(lock);
+    scored = score_items(list, option, keyword, workers, cancelled);
+  }
+  if (!scored) {
+    return 0;
+  }
+  apply_frecency(list, option, context.frecency, workers);
+  end_stage(stats.score, "score", start, Tracer::NONE, Tracer::NONE,
+            list.items.size());
+
+  const std::vector<uint32_t>& survivors = list.survivors;
+  size_t count = option.max_results > 0 ? option.max_results : survivors.size();
+  Clock::time_point normalized;
+  {
+    Unlocked unlocked(lock);
+    normalize_costs(list, workers);
+    normalized = Clock::now();
+    list.ranked = survivors;
+    list.ranked_sorted = 0;
+    list.ranking++;
+    rank_items(list, count);
+  }
+  end_stage(stats.normalize, "normalize", start, Tracer::NONE, Tracer::NONE,
+            survivors.size(), normalized);
+  end_stage(stats.sort, "sort", start, Tracer::NONE, Tracer::NONE, count);
+  stats.ranked.record(list.items.size());
+  stats.matched.record(survivors.size());
+  return count;
+}
+
+/**
+ * param1: bufnr
+ * param2: line (1-indexed)
+ * param3: col (1-indexed)
+ * param4: start (1-indexed)
+ * param5: edit distance option, or a profile of create_profile
+ * param6: cursor col (optional), when the items were cached at an earlier
+ *         col of the same word, see can_refilter
+ * param7: keyword, when param5 is a profile
+ */
+int lua_get_completion_items(lua_State* L) {
+  int bufnr = luaL_checkinteger(L, 1);
+  int line = luaL_checkinteger(L, 2);
+  int col = luaL_checkinteger(L, 3);
+  int start = luaL_checkinteger(L, 4);
+  int cursor = luaL_optinteger(L, 6, col);
+
+  CacheKey key{bufnr, line, col};
+  WordRange word{line, start, cursor};
+
+  EditDistanceOption parsed;
+  std::string_view keyword;
+  const EditDistanceOption& option = get_option(L, 5, 7, parsed, keyword);
+
+  std::lock_guard<std::mutex> lock(context.mutex);
+  Clock::time_point begin = Clock::now();
+  if (context.recorder.is_open()) {
+    record_query(key, word, option, keyword);
+  }
+  CompletionList* found = context.completion_items.lookup(key);
+  if (!found) {
+    context.ranked_key.reset();
+    lua_newtable(L);
+    return 1;
+  }
+  CompletionList& list = *found;
+  size_t count = rank_list(list, option, keyword, context.workers.get());
+  context.completion_items.set_bytes(key, list.bytes());
+
+  context.ranked_key = key;
+  context.ranked_word = word;
+  push_ranked_items(L, list, 0, count, key, word, option.lazy);
+  context.tracer.span("get_completion_items", begin, Clock::now(), bufnr,
+                      Tracer::NONE, list.items.size());
+  return 1;
+}
+
+/**
+ * param1: offset (0-indexed)
+ * param2: count
+ * param3: lazy (optional)
+ *
+ * returns the next items of the last get_completion_items ranking
+ */
+int lua_get_completion_page(lua_State* L) {
+  int offset = std::max(0, (int)luaL_checkinteger(L, 1));
+  int count = std::max(0, (int)luaL_checkinteger(L, 2));
+  bool lazy = lua_toboolean(L, 3);
+
+  std::lock_guard<std::mutex> lock(context.mutex);
+  const std::optional<CacheKey>& key = context.ranked_key;
+  if (!key || !context.completion_items.has_value(*key)) {
+    lua_newtable(L);
+    return 1;
+  }
+
+  CompletionList& list = context.completion_items.get(*key);
+  rank_items(list, offset + count);
+  push_ranked_items(L, list, offset, count, *key, context.ranked_word, lazy);
+  return 1;
+}
+
+// Copies what rank_list reads of the list at key into the snapshot, unless
+// it holds that list already.
+void take_snapshot(const CacheKey& key, const CompletionList& list,
+                   RankSnapshot& snapshot) {
+  if (snapshot.key == key && snapshot.generation == list.generation &&
+      snapshot.revision == list.revision) {
+    return;
+  }
+  snapshot.key = key;
+  snapshot.generation = list.generation;
+  snapshot.revision = list.revision;
+  snapshot.cleared = context.cleared;
+  snapshot.list = CompletionList();
+  snapshot.list.items = list.items;
+  snapshot.list.strings = list.strings;
+  snapshot.list.texts = list.texts;
+  snapshot.bytes = snapshot.list.bytes();
+}
+
+// Puts the ranking of the snapshot into list, which holds the same items.
+// Only the survivors were scored, so only their costs are copied.
+void store_ranking(const CompletionList& ranked, CompletionList& list) {
+  for (uint32_t i : ranked.survivors) {
+    list.items[i].cost = ranked.items[i].cost;
+  }
+  list.survivors = ranked.survivors;
+  list.last_keyword = ranked.last_keyword;
+  list.refinable = ranked.refinable;
+  list.ranked = ranked.ranked;
+  list.ranked_sorted = ranked.ranked_sorted;
+  list.ranking++;
+}
+
+// The rank_async job, runs on the ranker thread. The mutex is held to copy
+// the list and to store its ranking, not while it is scored, and a newer
+// request for the buffer stops the scoring between blocks.
+void rank_async(uint64_t id, CacheKey key, WordRange word,
+                const EditDistanceOption& option, const std::string& keyword) {
+  AsyncQueue* ranker = context.ranker.get();
+  auto cancelled = [ranker, id, bufnr = key.bufnr] {
+    return ranker->superseded(bufnr, id);
+  };
+  std::unique_lock<std::mutex> lock(context.mutex);
+  if (cancelled()) {
+    return;
+  }
+
+  RankResult result{id, key, 0, 0, word, 0, option.lazy};
+  Clock::time_point start = Clock::now();
+  if (context.recorder.is_open()) {
+    record_query(key, word, option, keyword);
+  }
+  if (CompletionList* list = context.completion_items.lookup(key)) {
+    RankSnapshot& snapshot = context.snapshot;
+    take_snapshot(key, *list, snapshot);
+    count_shared_bytes(&key);
+    std::shared_ptr<WorkerPool> workers = context.workers;
+    context.ranking = true;
+    size_t count =
+        rank_list(snapshot.list, option, keyword, workers.get(), &lock,
+                  cancelled);
+    context.ranking = false;
+    // the list may have changed or gone while the lock was let go, the copy
+    // is of no use then
+    list = context.completion_items.find(key);
+    if (!list || list->generation != snapshot.generation ||
+        list->revision != snapshot.revision ||
+        snapshot.cleared != context.cleared) {
+      context.snapshot = RankSnapshot();
+      count_shared_bytes();
+      return;
+    }
+    snapshot.bytes = snapshot.list.bytes();
+    count_shared_bytes(&key);
+    if (cancelled()) {
+      return;
+    }
+    store_ranking(snapshot.list, *list);
+    result.count = count;
+    result.generation = list->generation;
+    result.ranking = list->ranking;
+    context.tracer.span("rank_async", start, Clock::now(), key.bufnr,
+                        Tracer::NONE, list->items.size());
+    context.completion_items.set_bytes(key, list->bytes());
+  } else if (context.snapshot.key == key) {
+    context.snapshot = RankSnapshot();
+    count_shared_bytes();
+  }
+  // a newer request came in while this one ranked
+  if (cancelled()) {
+    return;
+  }
+  context.results[key.bufnr] = result;
+}
+
+AsyncQueue* get_ranker(lua_State* L) {
+  if (!context.ranker) {
+    context.ranker = std::make_unique<AsyncQueue>();
+  }
+  if (!context.ranker->ok()) {
+    luaL_error(L, "paw: cannot create the rank_async pipe");
+  }
+  return context.ranker.get();
+}
+
+/**
+ * Same parameters as get_completion_items.
+ *
+ * Ranks on a background thread and returns a request id right away. The fd
+ * of async_fd() turns readable when a ranking is done, take_result(id) then
+ * returns its items. A newer request for the same buffer drops older ones,
+ * one that is already scoring stops part way. The list is ranked as a copy,
+ * so calls on the main thread only wait while it is copied or its ranking
+ * stored.
+ */
+int lua_rank_async(lua_State* L) {
+  int bufnr = luaL_checkinteger(L, 1);
+  int line = luaL_checkinteger(L, 2);
+  int col = luaL_checkinteger(L, 3);
+  int start = luaL_checkinteger(L, 4);
+  int cursor = luaL_optinteger(L, 6, col);
+
+  CacheKey key{bufnr, line, col};
+  WordRange word{line, start, cursor};
+
+  EditDistanceOption parsed;
+  std::string_view keyword;
+  const EditDistanceOption& option = get_option(L, 5, 7, parsed, keyword);
+
+  AsyncQueue* ranker = get_ranker(L);
+  uint64_t id = ranker->submit(
+      bufnr, [key, word, option, keyword = std::string(keyword)](uint64_t id) {
+        rank_async(id, key, word, option, keyword);
+      });
+  lua_pushnumber(L, id);
+  return 1;
+}
+
+/**
+ * returns the fd to poll for finished rank_async requests
+ */
+int lua_async_fd(lua_State* L) {
+  lua_pushinteger(L, get_ranker(L)->fd());
+  return 1;
+}
+
+/**
+ * param1: request id from rank_async
+ *
+ * Returns the items like get_completion_items once the request is ranked,
+ * nil while it is still running or after it was superseded, taken or the
+ * list changed under it. Clears the async_fd wakeup.
+ */
+int lua_take_result(lua_State* L) {
+  uint64_t id = luaL_checknumber(L, 1);
+  if (context.ranker) {
+    context.ranker->drain();
+  }
+
+  std::lock_guard<std::mutex> lock(context.mutex);
+  auto it = std::find_if(
+      context.results.begin(), context.results.end(),
+      [id](const auto& entry) { return entry.second.id == id; });
+  if (it == context.results.end()) {
+    lua_pushnil(L);
+    return 1;
+  }
+  RankResult result = it->second;
+  context.results.erase(it);
+  if (context.ranker->superseded(result.key.bufnr, id)) {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  CompletionList* list = context.completion_items.find(result.key);
+  if (!list || list->generation != result.generation) {
+    context.ranked_key.reset();
+    lua_newtable(L);
+    return 1;
+  }
+  if (list->ranking != result.ranking) {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  context.ranked_key = result.key;
+  context.ranked_word = result.word;
+  push_ranked_items(L, *list, 0, result.count, result.key, result.word,
+                    result.lazy);
+  return 1;
+}
+
+/**
+ * param1: bufnr
+ * param2: line (1-indexed)
+ * param3: col (1-indexed)
+ */
+int lua_has_cache(lua_State* L) {
+  int bufnr = luaL_checkinteger(L, 1);
+  int line = luaL_checkinteger(L, 2);
+  int col = luaL_checkinteger(L, 3);
+
+  CacheKey key{bufnr, line, col};
+
+  std::lock_guard<std::mutex> lock(context.mutex);
+  bool has_value = context.completion_items.has_value(key);
+  lua_pushboolean(L, has_value);
+  return 1;
 }
 
 int lua_clear_completion_items(lua_State*) {
+  std::lock_guard<std::mutex> lock(context.mutex);
+  context.recorder.clear();
+  release_snapshot();
   context.completion_items.clear();
+  context.ranked_key.reset();
+  context.interned.clear();
+  count_shared_bytes();
+  context.responses.clear();
+  context.results.clear();
+  return 0;
+}
+
+/**
+ * param1: budget in bytes
+ */
+int lua_set_cache_budget(lua_State* L) {
+  double budget = luaL_checknumber(L, 1);
+  std::lock_guard<std::mutex> lock(context.mutex);
+  context.completion_items.set_budget(budget > 0 ? budget : 0);
+  return 0;
+}
+
+/**
+ * param1: number of threads scoring large lists, 0 or less uses every core
+ */
+int lua_set_worker_threads(lua_State* L) {
+  int threads = luaL_checkinteger(L, 1);
+  size_t size = threads > 0 ? threads : WorkerPool::default_size();
+  // a rank_async job scoring on the old pool keeps it until it is done
+  std::lock_guard<std::mutex> lock(context.mutex);
+  if (!context.workers || context.workers->size() != size) {
+    context.workers = std::make_shared<WorkerPool>(size);
+  }
+  return 0;
+}
+
+/**
+ * param1: client_id
+ * param2: priority, of duplicate items the higher one is kept
+ */
+int lua_set_client_priority(lua_State* L) {
+  int client_id = luaL_checkint(L, 1);
+  int priority = luaL_checkint(L, 2);
+  std::lock_guard<std::mutex> lock(context.mutex);
+  context.client_priority[client_id] = priority;
+  return 0;
+}
+
+int lua_cache_stats(lua_State* L) {
+  CacheStats stats;
+  size_t duplicates = 0;
+  size_t snapshot = 0;
+  size_t interned = 0;
+  {
+    std::lock_guard<std::mutex> lock(context.mutex);
+    stats = context.completion_items.stats();
+    duplicates = context.duplicates;
+    snapshot = context.snapshot.bytes;
+    interned = context.interned.bytes();
+  }
+  lua_newtable(L);
+  lua_pushnumber(L, stats.entries);
+  lua_setfield(L, -2, "entries");
+  lua_pushnumber(L, stats.bytes);
+  lua_setfield(L, -2, "bytes");
+  lua_pushnumber(L, stats.budget);
+  lua_setfield(L, -2, "budget");
+  lua_pushnumber(L, stats.hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushnumber(L, stats.misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushnumber(L, stats.evictions);
+  lua_setfield(L, -2, "evictions");
+  lua_pushnumber(L, snapshot);
+  lua_setfield(L, -2, "snapshot");
+  lua_pushnumber(L, interned);
+  lua_setfield(L, -2, "interned");
+  lua_pushnumber(L, duplicates);
+  lua_setfield(L, -2, "duplicates");
+  return 1;
+}
+
+void push_histogram(lua_State* L, const Histogram& histogram, double scale) {
+  lua_createtable(L, 0, 6);
+  lua_pushnumber(L, histogram.count());
+  lua_setfield(L, -2, "count");
+  lua_pushnumber(L, histogram.mean() * scale);
+  lua_setfield(L, -2, "mean");
+  lua_pushnumber(L, histogram.percentile(0.5) * scale);
+  lua_setfield(L, -2, "p50");
+  lua_pushnumber(L, histogram.percentile(0.9) * scale);
+  lua_setfield(L, -2, "p90");
+  lua_pushnumber(L, histogram.percentile(0.99) * scale);
+  lua_setfield(L, -2, "p99");
+  lua_pushnumber(L, histogram.max() * scale);
+  lua_setfield(L, -2, "max");
+}
+
+/**
+ * Returns a table of { count, mean, p50, p90, p99, max } per stage since
+ * luaopen or reset_stats: parse, score, normalize, sort and marshal in
+ * microseconds, inserted, ranked and matched in items per call.
+ */
+int lua_stats(lua_State* L) {
+  Stats stats;
+  {
+    std::lock_guard<std::mutex> lock(context.mutex);
+    stats = context.stats;
+  }
+  const double us = 1e-3;
+  lua_newtable(L);
+  push_histogram(L, stats.parse, us);
+  lua_setfield(L, -2, "parse");
+  push_histogram(L, stats.score, us);
+  lua_setfield(L, -2, "score");
+  push_histogram(L, stats.normalize, us);
+  lua_setfield(L, -2, "normalize");
+  push_histogram(L, stats.sort, us);
+  lua_setfield(L, -2, "sort");
+  push_histogram(L, stats.marshal, us);
+  lua_setfield(L, -2, "marshal");
+  push_histogram(L, stats.inserted, 1);
+  lua_setfield(L, -2, "inserted");
+  push_histogram(L, stats.ranked, 1);
+  lua_setfield(L, -2, "ranked");
+  push_histogram(L, stats.matched, 1);
+  lua_setfield(L, -2, "matched");
+  return 1;
+}
+
+int lua_reset_stats(lua_State*) {
+  std::lock_guard<std::mutex> lock(context.mutex);
+  context.stats = Stats{};
   return 0;
 }
 
+/**
+ * param1: enabled
+ * param2: spans kept (optional), the oldest are dropped past it
+ *
+ * Enabling drops the spans kept so far.
+ */
+int lua_set_trace(lua_State* L) {
+  if (lua_toboolean(L, 1)) {
+    lua_Integer capacity =
+        luaL_optinteger(L, 2, Tracer::DEFAULT_CAPACITY);
+    context.tracer.enable(std::max<lua_Integer>(capacity, 0));
+  } else {
+    context.tracer.disable();
+  }
+  return 0;
+}
+
+// microseconds on the tracer clock, the start of a trace_span
+int lua_trace_now(lua_State* L) {
+  lua_pushnumber(L, std::chrono::duration<double, std::micro>(
+                        Clock::now().time_since_epoch())
+                        .count());
+  return 1;
+}
+
+/**
+ * param1: name
+ * param2: start from trace_now
+ * param3: bufnr (optional)
+ * param4: client_id (optional)
+ * param5: item count (optional)
+ *
+ * Records a span from start until now, for the stages that run in lua.
+ */
+int lua_trace_span(lua_State* L) {
+  if (!context.tracer.enabled()) {
+    return 0;
+  }
+  Clock::time_point end = Clock::now();
+  size_t length = 0;
+  const char* name = luaL_checklstring(L, 1, &length);
+  std::chrono::duration<double, std::micro> start_us(luaL_checknumber(L, 2));
+  Clock::time_point start(
+      std::chrono::duration_cast<Clock::duration>(start_us));
+  int bufnr = luaL_optinteger(L, 3, Tracer::NONE);
+  int client_id = luaL_optinteger(L, 4, Tracer::NONE);
+  int64_t items = luaL_optinteger(L, 5, Tracer::NONE);
+  context.tracer.span(std::string_view(name, length), start, end, bufnr,
+                      client_id, items);
+  return 0;
+}
+
+/**
+ * param1: path
+ *
+ * Writes the spans kept as chrome trace event json, for perfetto or
+ * chrome://tracing. Returns true, or nil and the error.
+ */
+int lua_trace_dump(lua_State* L) {
+  std::string path = luaL_checkstring(L, 1);
+  if (!context.tracer.dump(path)) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(errno));
+    return 2;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+/**
+ * param1: path of the session file, overwritten
+ * param2: anonymize (optional), "scramble" permutes the letters of every
+ *         label and keyword and blanks details, "hash" hashes every string.
+ *         Both write sort texts as their rank within the call. The letter
+ *         permutation is a plain substitution cipher anyone can reverse by
+ *         hand, it only keeps names from a casual look.
+ *
+ * Records every insert_items, get_completion_items, rank_async and
+ * clear_completion_items call until stop_recording, for paw_replay. Returns
+ * true, or nil and the error.
+ */
+int lua_start_recording(lua_State* L) {
+  std::string path = luaL_checkstring(L, 1);
+  auto mode = lua_isstring(L, 2) ? std::optional<std::string>(lua_tostring(L, 2))
+                                 : std::nullopt;
+  Anonymize anonymize = Anonymize::NONE;
+  if (mode == "scramble") {
+    anonymize = Anonymize::SCRAMBLE;
+  } else if (mode == "hash") {
+    anonymize = Anonymize::HASH;
+  } else if (mode) {
+    return luaL_error(L, "unknown anonymize mode %s", mode->c_str());
+  }
+  std::lock_guard<std::mutex> lock(context.mutex);
+  if (!context.recorder.open(path, anonymize)) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(errno));
+    return 2;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// returns whether every call made it into the file
+int lua_stop_recording(lua_State* L) {
+  std::lock_guard<std::mutex> lock(context.mutex);
+  lua_pushboolean(L, context.recorder.close());
+  return 1;
+}
+
 int lua_get_stars(lua_State* L) {
   double cost = luaL_checknumber(L, 1);
   double p = (1.0 - cost) * 5;
@@ -885,7 +2570,33 @@ int lua_format_completion_item(lua_State* L) {
 }
 
 // paw module
+void register_metatables(lua_State* L) {
+  luaL_newmetatable(L, COMPLETION_RESULT);
+  lua_pushcfunction(L, lua_completion_result_index);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, lua_completion_result_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, lua_completion_result_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+
+  luaL_newmetatable(L, COMPLETION_ITEM);
+  lua_pushcfunction(L, lua_completion_item_index);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+
+  luaL_newmetatable(L, SCORING_PROFILE);
+  lua_pushcfunction(L, lua_scoring_profile_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+}
+
 extern "C" int luaopen_paw(lua_State* L) {
+  register_metatables(L);
+  if (!context.workers) {
+    context.workers = std::make_shared<WorkerPool>(WorkerPool::default_size());
+  }
+
   lua_newtable(L);
 
   lua_pushcfunction(L, lua_trim_long_text);
@@ -918,9 +2629,87 @@ extern "C" int luaopen_paw(lua_State* L) {
   lua_pushcfunction(L, lua_get_completion_items);
   lua_setfield(L, -2, "get_completion_items");
 
+  lua_pushcfunction(L, lua_get_completion_page);
+  lua_setfield(L, -2, "get_completion_page");
+
   lua_pushcfunction(L, lua_has_cache);
   lua_setfield(L, -2, "has_cache");
 
+  lua_pushcfunction(L, lua_can_refilter);
+  lua_setfield(L, -2, "can_refilter");
+
+  lua_pushcfunction(L, lua_set_buffer_lines);
+  lua_setfield(L, -2, "set_buffer_lines");
+
+  lua_pushcfunction(L, lua_clear_buffer_words);
+  lua_setfield(L, -2, "clear_buffer_words");
+
+  lua_pushcfunction(L, lua_insert_buffer_words);
+  lua_setfield(L, -2, "insert_buffer_words");
+
+  lua_pushcfunction(L, lua_open_frecency);
+  lua_setfield(L, -2, "open_frecency");
+
+  lua_pushcfunction(L, lua_record_selection);
+  lua_setfield(L, -2, "record_selection");
+
+  lua_pushcfunction(L, lua_load_response_cache);
+  lua_setfield(L, -2, "load_response_cache");
+
+  lua_pushcfunction(L, lua_save_response_cache);
+  lua_setfield(L, -2, "save_response_cache");
+
+  lua_pushcfunction(L, lua_insert_saved_items);
+  lua_setfield(L, -2, "insert_saved_items");
+
+  lua_pushcfunction(L, lua_set_cache_budget);
+  lua_setfield(L, -2, "set_cache_budget");
+
+  lua_pushcfunction(L, lua_cache_stats);
+  lua_setfield(L, -2, "cache_stats");
+
+  lua_pushcfunction(L, lua_stats);
+  lua_setfield(L, -2, "stats");
+
+  lua_pushcfunction(L, lua_reset_stats);
+  lua_setfield(L, -2, "reset_stats");
+
+  lua_pushcfunction(L, lua_set_trace);
+  lua_setfield(L, -2, "set_trace");
+
+  lua_pushcfunction(L, lua_trace_now);
+  lua_setfield(L, -2, "trace_now");
+
+  lua_pushcfunction(L, lua_trace_span);
+  lua_setfield(L, -2, "trace_span");
+
+  lua_pushcfunction(L, lua_trace_dump);
+  lua_setfield(L, -2, "trace_dump");
+
+  lua_pushcfunction(L, lua_start_recording);
+  lua_setfield(L, -2, "start_recording");
+
+  lua_pushcfunction(L, lua_stop_recording);
+  lua_setfield(L, -2, "stop_recording");
+
+  lua_pushcfunction(L, lua_set_worker_threads);
+  lua_setfield(L, -2, "set_worker_threads");
+
+  lua_pushcfunction(L, lua_set_client_priority);
+  lua_setfield(L, -2, "set_client_priority");
+
+  lua_pushcfunction(L, lua_create_profile);
+  lua_setfield(L, -2, "create_profile");
+
+  lua_pushcfunction(L, lua_rank_async);
+  lua_setfield(L, -2, "rank_async");
+
+  lua_pushcfunction(L, lua_async_fd);
+  lua_setfield(L, -2, "async_fd");
+
+  lua_pushcfunction(L, lua_take_result);
+  lua_setfield(L, -2, "take_result");
+
   lua_pushcfunction(L, lua_clear_completion_items);
   lua_setfield(L, -2, "clear_completion_items");
 
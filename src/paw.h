@@ -3,14 +3,28 @@
 
 #include <chrono>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string>
 #include <vector>
 #include <mutex>
 
 #include <absl/container/flat_hash_map.h>
+#include <absl/container/flat_hash_set.h>
 
+#include "async_queue.h"
+#include "buffer_words.h"
+#include "edit_distance.h"
+#include "frecency.h"
+#include "histogram.h"
 #include "lfu.h"
+#include "packed_texts.h"
+#include "pair_index.h"
+#include "response_cache.h"
+#include "session_log.h"
+#include "string_arena.h"
+#include "trace.h"
+#include "worker_pool.h"
 
 enum CompletionItemKind {
   Text = 1,
@@ -56,29 +70,55 @@ struct Range {
   Position end;
 };
 
+enum TextEditRange {
+  RANGE = 1,
+  INSERT = 2,
+  REPLACE = 4,
+};
+
 struct TextEdit {
-  std::string new_text;
-  std::optional<Range> range;
-  std::optional<Range> insert;
-  std::optional<Range> replace;
+  StringRef new_text;
+  // the ranges present, stored from first_range on in CompletionList::ranges
+  // in the order range, insert, replace
+  uint32_t first_range;
+  uint8_t ranges;
 };
 
+// The strings of an item live in the StringArena of its CompletionList.
 struct CompletionItem {
-  std::string label;
+  StringRef label;
+  StringRef sort_text;
+  StringRef filter_text;
+  StringRef insert_text;
+  // id in Context::interned
+  uint32_t detail = InternPool::NONE;
   std::optional<CompletionItemKind> kind;
-  std::optional<std::string> detail;
-  std::optional<std::string> sort_text;
-  std::optional<std::string> filter_text;
-  std::optional<std::string> insert_text;
   std::optional<int> insert_text_format;
   std::optional<TextEdit> text_edit;
+  // fnv1a() of the label, with the filetype it keys the FrecencyStore
+  uint64_t label_hash;
   int client_id;
   double cost;
-  bool is_subseq;
+};
+
+enum EditDistanceKernel {
+  AUTO,
+  DP,
+  BIT_PARALLEL,
+  SIMD,
+};
+
+// how survivors are scored against the keyword
+enum Scorer {
+  // weighted edit distance, see compute_cost
+  LEVENSHTEIN,
+  // fzf v2 alignment with bonuses for word starts, camelCase humps and runs
+  FZF,
 };
 
 struct EditDistanceOption {
   std::string keyword;
+  Scorer scorer;
   int insert_cost;
   int delete_cost;
   int substitude_cost;
@@ -86,6 +126,34 @@ struct EditDistanceOption {
   double max_cost;
   double beta;
   double gamma;
+  EditDistanceKernel kernel;
+  // 0 returns every match
+  int max_results;
+  // return a CompletionResult userdata instead of a table of items
+  bool lazy;
+  // lists with at least this many items are filtered through a PairIndex,
+  // 0 always scans
+  int index_threshold;
+  // filetype of the buffer, accepts are counted per filetype
+  std::string filetype;
+  // how far accepted items move up, 0 ignores the FrecencyStore
+  double frecency_boost;
+  // select_batch_distance() of the costs
+  BatchDistance batch_distance;
+  // kernel as settle_kernel() left it for the weights and the cpu, only AUTO
+  // when the keyword length decides
+  EditDistanceKernel settled_kernel;
+  // keywords at least this long go bit-parallel when settled_kernel is AUTO
+  int bit_parallel_length;
+  // largest of the costs, compute_cost divides by it
+  int largest_cost;
+};
+
+// An EditDistanceOption checked and settled once by create_profile, every
+// call after only passes the keyword and leaves it as it is. Lives in a Lua
+// userdata.
+struct ScoringProfile {
+  EditDistanceOption option;
 };
 
 struct CompletionParam {
@@ -131,19 +199,269 @@ struct CacheKey {
   }
 };
 
+// The word being completed, from start up to the cursor on line. Items
+// without a text edit replace it. line and start are 1-indexed.
+struct WordRange {
+  int line;
+  int start;
+  int cursor;
+};
+
+// one client's response for the word starting at start
+struct WordKey {
+  int bufnr;
+  int line;
+  int start;
+  int client_id;
+
+  bool operator==(const WordKey& key) const {
+    return bufnr == key.bufnr && line == key.line && start == key.start &&
+           client_id == key.client_id;
+  }
+
+  template <typename H>
+  friend H AbslHashValue(H h, const WordKey& key) {
+    return H::combine(std::move(h), key.bufnr, key.line, key.start,
+                      key.client_id);
+  }
+};
+
+struct WordResponse {
+  // col of the CacheKey the items went to
+  int col;
+  // the word when the request was sent
+  std::string word;
+  // isIncomplete, the server wants to be asked again as the word grows
+  bool incomplete;
+};
+
 struct HashCacheKey {
   size_t operator()(const CacheKey& key) const {
     return std::hash<int>()(key.bufnr) ^ std::hash<int>()(key.line) ^ std::hash<int>()(key.col);
   }
 };
 
+struct CompletionList {
+  std::vector<CompletionItem> items;
+  StringArena strings;
+  std::vector<Range> ranges;
+  // get_text() of every item, packed for the scoring pass
+  PackedTexts texts;
+  // Items that were a subsequence of the last keyword, in by_length order.
+  // A keyword extending the last one can only match among these.
+  std::vector<uint32_t> survivors;
+  std::string last_keyword;
+  // built by the first scan of a large list, dropped on insert
+  PairIndex index;
+  bool refinable = false;
+  // survivors in rank order, only the first ranked_sorted are sorted and the
+  // rest all rank below them
+  std::vector<uint32_t> ranked;
+  size_t ranked_sorted = 0;
+  // bumped whenever ranked is rebuilt
+  uint64_t ranking = 0;
+  // tells a list apart from one cached later under the same key
+  uint64_t generation = 0;
+  // bumped whenever items are added, a copy of the list with the same
+  // generation and revision still holds the same items
+  uint64_t revision = 0;
+  // hash of an item's lowercased text and kind to the first item with them,
+  // a duplicate from another client is merged into that item
+  absl::flat_hash_map<size_t, uint32_t> dedup;
+
+  // approximate heap bytes held, the interned details it shares with the
+  // other lists are counted once for all of them, see count_shared_bytes
+  size_t bytes() const {
+    return sizeof(CompletionList) +
+           items.capacity() * sizeof(CompletionItem) + strings.bytes() +
+           ranges.capacity() * sizeof(Range) + texts.lower.capacity() +
+           texts.bonuses.capacity() +
+           (texts.offsets.capacity() + texts.lengths.capacity() +
+            texts.by_length.capacity() + survivors.capacity() +
+            ranked.capacity()) *
+               sizeof(uint32_t) +
+           texts.masks.capacity() * sizeof(uint64_t) + index.bytes() +
+           dedup.capacity() * (sizeof(size_t) + sizeof(uint32_t)) +
+           last_keyword.capacity();
+  }
+};
+
+// A ranked slice of a completion list handed to Lua as userdata. Items are
+// read through __index when Lua touches them, so nothing is built for rows
+// that are never shown. The ranking and costs are copied because the next
+// keystroke ranks the list again. Once the list is cleared or evicted every
+// index reads as nil.
+struct CompletionResult {
+  CacheKey key;
+  uint64_t generation;
+  WordRange word;
+  std::vector<uint32_t> indices;
+  std::vector<double> costs;
+};
+
+// one item of a CompletionResult, its fields are pushed on access
+struct CompletionItemHandle {
+  CacheKey key;
+  uint64_t generation;
+  WordRange word;
+  uint32_t index;
+  double cost;
+};
+
+// The items, strings and texts of a cached list, ranked by the rank_async
+// thread without holding the mutex. It is kept while the list stays the same
+// so typing on copies the list once, and let go once the list changed, went
+// away or the cache was cleared. Its bytes count against the cache budget.
+struct RankSnapshot {
+  CacheKey key{};
+  uint64_t generation = 0;
+  uint64_t revision = 0;
+  // Context::cleared when it was taken
+  uint64_t cleared = 0;
+  // list.bytes() as of the last time the mutex was held
+  size_t bytes = 0;
+  CompletionList list;
+};
+
+// a rank_async ranking waiting for take_result, the items are read from
+// list.ranked once it is taken
+struct RankResult {
+  uint64_t id;
+  CacheKey key;
+  uint64_t generation;
+  uint64_t ranking;
+  WordRange word;
+  size_t count;
+  bool lazy;
+};
+
+// the client_id of items completed from the words of a buffer, nvim numbers
+// its clients from 1
+constexpr int BUFFER_WORDS_CLIENT = 0;
+// the client_id of items served from the last session's ResponseCache
+constexpr int RESPONSE_CACHE_CLIENT = -1;
+// what save_response_cache keeps
+constexpr size_t MAX_SAVED_FILES = 200;
+constexpr size_t MAX_SAVED_ITEMS = 5000;
+
+// Always on, read by paw.stats(). Stages are in nanoseconds, sizes in items.
+struct Stats {
+  // insert_items parsing and appending its items
+  Histogram parse;
+  // subsequence filter, edit distance and frecency of a ranking
+  Histogram score;
+  Histogram normalize;
+  Histogram sort;
+  // pushing the ranked items to lua
+  Histogram marshal;
+  // items per insert_items call
+  Histogram inserted;
+  // items of the lists ranked, and how many of them matched
+  Histogram ranked;
+  Histogram matched;
+};
+
 constexpr int DEFAULT_CACHE_SIZE = 32768;
+constexpr size_t DEFAULT_CACHE_BUDGET = 256 << 20;
 
 struct Context {
+  Context() { completion_items.set_budget(DEFAULT_CACHE_BUDGET); }
+
+  // held by the calls that read or write the cache, and by the rank_async
+  // thread while it copies a list and stores its ranking
   std::mutex mutex;
-  LFU<CacheKey, std::vector<CompletionItem>, HashCacheKey, DEFAULT_CACHE_SIZE> completion_items;
+  LFU<CacheKey, CompletionList, HashCacheKey, DEFAULT_CACHE_SIZE> completion_items;
   // absl::flat_hash_map<CacheKey, std::vector<CompletionItem>, HashCacheKey> completion_items;
+  // the list ranked by the last get_completion_items, for get_completion_page
+  std::optional<CacheKey> ranked_key;
+  WordRange ranked_word;
+  // responses that can be filtered again while their word is typed
+  absl::flat_hash_map<WordKey, WordResponse> responses;
+  // details shared by all completion lists
+  InternPool interned;
+  // of two duplicate items the one from the client with the higher priority
+  // is kept, clients default to 0
+  absl::flat_hash_map<int, int> client_priority;
+  // items merged into a duplicate by insert_items
+  size_t duplicates = 0;
+  Stats stats;
+  // spans of the stages while paw.set_trace is on
+  Tracer tracer;
+  // the calls of the session while paw.start_recording is on
+  SessionWriter recorder;
+  uint64_t generation = 0;
+  // scores large lists in parallel, created in luaopen_paw. A rank_async job
+  // keeps the pool it started on while set_worker_threads replaces it.
+  std::shared_ptr<WorkerPool> workers;
+  // accepted completions, opened by open_frecency
+  FrecencyStore frecency;
+  // the responses of the last session, loaded by load_response_cache
+  ResponseCache saved_responses;
+  // buffers a server responded for this session, saved responses are not
+  // served there anymore
+  absl::flat_hash_set<int> live_buffers;
+  // the words of every attached buffer by bufnr
+  absl::flat_hash_map<int, BufferWords> buffer_words;
+  // the newest finished rank_async per buffer
+  absl::flat_hash_map<int, RankResult> results;
+  // the list rank_async ranked last, only the ranker thread touches its list
+  // while ranking is set
+  RankSnapshot snapshot;
+  bool ranking = false;
+  // bumped by every clear, a snapshot from before one is dropped
+  uint64_t cleared = 0;
   Cat cat;
+  // runs rank_async, declared last so its thread stops before the rest of
+  // the context goes away
+  std::unique_ptr<AsyncQueue> ranker;
 };
 
+// The ranking pipeline of paw.cc, declared here for bench/paw_bench.cc.
+
+// orders item indices of one list
+struct CompareCompletionItem {
+  const CompletionList& list;
+
+  bool operator()(uint32_t i, uint32_t j) const {
+    const CompletionItem& a = list.items[i];
+    const CompletionItem& b = list.items[j];
+    int format_a = a.insert_text_format ? *a.insert_text_format : 1;
+    int format_b = b.insert_text_format ? *b.insert_text_format : 1;
+    if (format_a == format_b) {
+      double cost_a = a.cost;
+      double cost_b = b.cost;
+
+      if (cost_a != cost_b) {
+        return cost_a < cost_b;
+      }
+
+      if (a.sort_text.has_value() && b.sort_text.has_value()) {
+        return list.strings.get(a.sort_text) < list.strings.get(b.sort_text);
+      }
+      return list.strings.get(a.label) < list.strings.get(b.label);
+    }
+    return format_a > format_b;
+  }
+};
+
+struct lua_State;
+
+std::string_view get_text(const CompletionList& list,
+                          const CompletionItem& item);
+// the dp, with the weights and alpha of option against option.keyword
+int edit_distance(std::string_view text, const EditDistanceOption& option);
+// picks the kernels of option for its weights, once per option
+void settle_kernel(EditDistanceOption& option);
+double compute_cost(std::string_view text, int dist, std::string_view keyword,
+                    const EditDistanceOption& option);
+bool append_item(CompletionList& list, CompletionItem&& item, int client_id);
+// scores, normalizes and ranks list, returns the size of the first page
+size_t rank_list(CompletionList& list, const EditDistanceOption& option,
+                 std::string_view keyword, WorkerPool* workers,
+                 std::unique_lock<std::mutex>* lock = nullptr,
+                 const std::function<bool()>& cancelled = nullptr);
+void push_completion_item(lua_State* L, const CompletionList& list,
+                          const CompletionItem& item,
+                          const InternPool& interned, const WordRange& word);
+
 #endif /* end of include guard: PAW_H */
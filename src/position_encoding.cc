@@ -0,0 +1,143 @@
+#include "position_encoding.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "edit_distance.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PAW_X86
+#endif
+
+namespace {
+
+bool scalar_is_ascii(const char* s, size_t n) {
+  uint64_t bits = 0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t word;
+    memcpy(&word, s + i, sizeof(word));
+    bits |= word;
+  }
+  for (; i < n; ++i) {
+    bits |= static_cast<unsigned char>(s[i]);
+  }
+  return (bits & 0x8080808080808080ull) == 0;
+}
+
+#ifdef PAW_X86
+
+// the high bits of 32 bytes at a time, or-ed so the loop has no branch
+__attribute__((target("avx2"))) bool avx2_is_ascii(const char* s, size_t n) {
+  __m256i bits = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    bits = _mm256_or_si256(bits,
+                           _mm256_loadu_si256((const __m256i*)(s + i)));
+  }
+  return _mm256_movemask_epi8(bits) == 0 && scalar_is_ascii(s + i, n - i);
+}
+
+// sse2 is part of every x86-64 cpu
+__attribute__((target("sse2"))) bool sse2_is_ascii(const char* s, size_t n) {
+  __m128i bits = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    bits = _mm_or_si128(bits, _mm_loadu_si128((const __m128i*)(s + i)));
+  }
+  return _mm_movemask_epi8(bits) == 0 && scalar_is_ascii(s + i, n - i);
+}
+
+#endif
+
+// bytes of the utf-8 sequence starting with lead, 1 for a stray byte
+int sequence_length(unsigned char lead) {
+  if (lead < 0xc0) {
+    return 1;
+  }
+  if (lead < 0xe0) {
+    return 2;
+  }
+  return lead < 0xf0 ? 3 : 4;
+}
+
+}  // namespace
+
+PositionEncoding parse_position_encoding(std::string_view name) {
+  if (name == "utf-8") {
+    return PositionEncoding::UTF8;
+  }
+  if (name == "utf-32") {
+    return PositionEncoding::UTF32;
+  }
+  return PositionEncoding::UTF16;
+}
+
+bool is_ascii(std::string_view s) {
+#ifdef PAW_X86
+  if (detect_simd_level() == AVX2) {
+    return avx2_is_ascii(s.data(), s.size());
+  }
+  return sse2_is_ascii(s.data(), s.size());
+#else
+  return scalar_is_ascii(s.data(), s.size());
+#endif
+}
+
+LineColumns::LineColumns(std::string_view line) : ascii_(is_ascii(line)) {
+  if (ascii_) {
+    return;
+  }
+  bytes_.reserve(line.size() + 1);
+  utf16_.reserve(line.size() + 1);
+  uint32_t utf16 = 0;
+  for (size_t i = 0; i < line.size();) {
+    int length = sequence_length(line[i]);
+    // a sequence cut short by the end of the line or by a byte that does
+    // not continue it falls back to one code point per byte
+    int valid = 1;
+    while (valid < length && i + valid < line.size() &&
+           (static_cast<unsigned char>(line[i + valid]) & 0xc0) == 0x80) {
+      valid++;
+    }
+    if (valid < length) {
+      length = 1;
+    }
+    bytes_.push_back(i);
+    utf16_.push_back(utf16);
+    i += length;
+    // code points above the basic plane take a surrogate pair
+    utf16 += length == 4 ? 2 : 1;
+  }
+  bytes_.push_back(line.size());
+  utf16_.push_back(utf16);
+}
+
+int LineColumns::convert(int column, PositionEncoding from,
+                         PositionEncoding to) const {
+  if (ascii_ || from == to || column <= 0) {
+    return column;
+  }
+  // the code point the column starts, the last entry is the end of the line
+  const size_t end = bytes_.size() - 1;
+  size_t point;
+  if (from == PositionEncoding::UTF32) {
+    point = std::min<size_t>(column, end);
+  } else {
+    const std::vector<uint32_t>& offsets =
+        from == PositionEncoding::UTF8 ? bytes_ : utf16_;
+    point = std::upper_bound(offsets.begin(), offsets.end(),
+                             static_cast<uint32_t>(column)) -
+            offsets.begin() - 1;
+  }
+  switch (to) {
+    case PositionEncoding::UTF8:
+      return bytes_[point];
+    case PositionEncoding::UTF16:
+      return utf16_[point];
+    case PositionEncoding::UTF32:
+      return point;
+  }
+  return column;
+}
@@ -0,0 +1,43 @@
+#ifndef POSITION_ENCODING_H
+#define POSITION_ENCODING_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// the units LSP positions count characters in
+enum class PositionEncoding {
+  UTF8,
+  UTF16,
+  UTF32,
+};
+
+// "utf-8", "utf-16" or "utf-32", anything else is the LSP default utf-16
+PositionEncoding parse_position_encoding(std::string_view name);
+
+// whether every byte of s is below 0x80, a vector of bytes at a time
+bool is_ascii(std::string_view s);
+
+// The columns of one line in every encoding. The line is scanned once: an
+// ascii line converts as is, any other line keeps the byte and utf-16 offset
+// of each code point so a conversion is a binary search. Bytes of invalid
+// utf-8 count as one code point each.
+class LineColumns {
+ public:
+  explicit LineColumns(std::string_view line);
+
+  bool ascii() const { return ascii_; }
+
+  // column counted in from as counted in to. Unless the line is ascii, where
+  // every encoding counts the same, a column inside a character moves to its
+  // start and one past the end of the line to the end.
+  int convert(int column, PositionEncoding from, PositionEncoding to) const;
+
+ private:
+  bool ascii_;
+  // offsets of every code point and of the end of the line
+  std::vector<uint32_t> bytes_;
+  std::vector<uint32_t> utf16_;
+};
+
+#endif /* end of include guard: POSITION_ENCODING_H */
@@ -0,0 +1,164 @@
+#include "response_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+constexpr char MAGIC[4] = {'P', 'A', 'W', 'R'};
+constexpr uint32_t VERSION = 1;
+
+bool write_all(int fd, const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+}  // namespace
+
+ResponseCache::~ResponseCache() { close(); }
+
+void ResponseCache::close() {
+  files_.clear();
+  if (data_) {
+    munmap(data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+}
+
+bool ResponseCache::load(const std::string& path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+    ::close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file alive
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  data_ = data;
+  size_ = size;
+
+  const Header* h = header();
+  uint64_t records = sizeof(Header) +
+                     uint64_t(h->file_count) * sizeof(FileRecord) +
+                     uint64_t(h->item_count) * sizeof(ItemRecord);
+  bool valid = memcmp(h->magic, MAGIC, sizeof(MAGIC)) == 0 &&
+               h->version == VERSION && records <= h->strings_offset &&
+               h->strings_offset + h->strings_size <= size_;
+  for (uint32_t i = 0; valid && i < h->file_count; ++i) {
+    const FileRecord& file = file_records()[i];
+    valid = uint64_t(file.first_item) + file.item_count <= h->item_count;
+    if (valid) {
+      files_.emplace(string(file.path), i);
+    }
+  }
+  if (!valid) {
+    close();
+  }
+  return valid;
+}
+
+std::string_view ResponseCache::string(const StringRecord& s) const {
+  const Header* h = header();
+  // a record out of bounds reads as empty instead of past the mapping
+  if (uint64_t(s.offset) + s.length > h->strings_size) {
+    return std::string_view();
+  }
+  return std::string_view(
+      static_cast<const char*>(data_) + h->strings_offset + s.offset,
+      s.length);
+}
+
+ResponseCache::ItemView ResponseCache::item(uint32_t i) const {
+  const ItemRecord& r = item_records()[i];
+  return ItemView{string(r.label),       string(r.filter_text),
+                  string(r.insert_text), string(r.sort_text),
+                  string(r.detail),      r.kind,
+                  r.insert_text_format};
+}
+
+std::vector<std::string_view> ResponseCache::paths() const {
+  std::vector<std::string_view> paths;
+  if (!data_) {
+    return paths;
+  }
+  for (uint32_t i = 0; i < header()->file_count; ++i) {
+    paths.push_back(string(file_records()[i].path));
+  }
+  return paths;
+}
+
+bool ResponseCache::save(const std::string& path,
+                         const std::vector<SavedFile>& files) {
+  std::string strings;
+  auto add = [&strings](std::string_view s) {
+    StringRecord record{static_cast<uint32_t>(strings.size()),
+                        static_cast<uint32_t>(s.size())};
+    strings.append(s);
+    return record;
+  };
+
+  std::vector<FileRecord> file_records;
+  std::vector<ItemRecord> item_records;
+  for (const SavedFile& file : files) {
+    file_records.push_back(FileRecord{add(file.path),
+                                      static_cast<uint32_t>(item_records.size()),
+                                      static_cast<uint32_t>(file.items.size())});
+    for (const SavedItem& item : file.items) {
+      item_records.push_back(ItemRecord{
+          add(item.label), add(item.filter_text), add(item.insert_text),
+          add(item.sort_text), add(item.detail), item.kind,
+          item.insert_text_format, {0, 0}});
+    }
+  }
+
+  Header header{};
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.file_count = file_records.size();
+  header.item_count = item_records.size();
+  header.strings_offset = sizeof(Header) +
+                          file_records.size() * sizeof(FileRecord) +
+                          item_records.size() * sizeof(ItemRecord);
+  header.strings_size = strings.size();
+
+  std::string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = write_all(fd, &header, sizeof(header)) &&
+            write_all(fd, file_records.data(),
+                      file_records.size() * sizeof(FileRecord)) &&
+            write_all(fd, item_records.data(),
+                      item_records.size() * sizeof(ItemRecord)) &&
+            write_all(fd, strings.data(), strings.size());
+  ok = ::close(fd) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
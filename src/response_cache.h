@@ -0,0 +1,128 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <absl/container/flat_hash_map.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// an item as kept across sessions, text edits are left out as their ranges
+// are stale by then
+struct SavedItem {
+  std::string label;
+  std::string filter_text;
+  std::string insert_text;
+  std::string sort_text;
+  std::string detail;
+  // 0 when the server sent none
+  uint8_t kind = 0;
+  uint8_t insert_text_format = 0;
+};
+
+struct SavedFile {
+  std::string path;
+  std::vector<SavedItem> items;
+};
+
+// The completion items of the last session by file path, in a versioned
+// binary file that is memory mapped on load. Only the table of files is read
+// then, the items and strings are read from the mapping when a file is
+// looked up.
+class ResponseCache {
+ public:
+  // fields point into the mapping, valid until the next load() or close()
+  struct ItemView {
+    std::string_view label;
+    std::string_view filter_text;
+    std::string_view insert_text;
+    std::string_view sort_text;
+    std::string_view detail;
+    uint8_t kind;
+    uint8_t insert_text_format;
+  };
+
+  ResponseCache() = default;
+  ~ResponseCache();
+
+  ResponseCache(const ResponseCache&) = delete;
+  ResponseCache& operator=(const ResponseCache&) = delete;
+
+  // false when path is missing, from another version or malformed
+  bool load(const std::string& path);
+  void close();
+
+  // calls fn for every saved item of the file at path
+  template <typename Fn>
+  void for_each_item(std::string_view path, Fn&& fn) const {
+    auto it = files_.find(path);
+    if (it == files_.end()) {
+      return;
+    }
+    const FileRecord& file = file_records()[it->second];
+    for (uint32_t i = 0; i < file.item_count; ++i) {
+      fn(item(file.first_item + i));
+    }
+  }
+
+  // paths of the saved files, in the order saved
+  std::vector<std::string_view> paths() const;
+
+  // Writes files to path through a temporary file and a rename, so a
+  // mapping of the old file stays valid.
+  static bool save(const std::string& path,
+                   const std::vector<SavedFile>& files);
+
+ private:
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t item_count;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+  };
+
+  struct StringRecord {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  struct FileRecord {
+    StringRecord path;
+    uint32_t first_item;
+    uint32_t item_count;
+  };
+
+  struct ItemRecord {
+    StringRecord label;
+    StringRecord filter_text;
+    StringRecord insert_text;
+    StringRecord sort_text;
+    StringRecord detail;
+    uint8_t kind;
+    uint8_t insert_text_format;
+    uint8_t padding[2];
+  };
+
+  const Header* header() const {
+    return static_cast<const Header*>(data_);
+  }
+  const FileRecord* file_records() const {
+    return reinterpret_cast<const FileRecord*>(header() + 1);
+  }
+  const ItemRecord* item_records() const {
+    return reinterpret_cast<const ItemRecord*>(file_records() +
+                                               header()->file_count);
+  }
+  std::string_view string(const StringRecord& s) const;
+  ItemView item(uint32_t i) const;
+
+  void* data_ = nullptr;
+  size_t size_ = 0;
+  // file path to its index in file_records()
+  absl::flat_hash_map<std::string_view, uint32_t> files_;
+};
+
+#endif /* end of include guard: RESPONSE_CACHE_H */
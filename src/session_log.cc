@@ -0,0 +1,403 @@
+#include "session_log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+#include "frecency.h"
+
+namespace {
+
+constexpr char MAGIC[4] = {'P', 'A', 'W', 'S'};
+constexpr uint32_t VERSION = 2;
+// buffered bytes written out at once
+constexpr size_t FLUSH_SIZE = 1 << 16;
+
+// the text edit ranges in file order, the TextEditRange bits of paw.h
+constexpr uint8_t RANGE_BITS[3] = {1, 2, 4};
+
+}  // namespace
+
+SessionWriter::~SessionWriter() { close(); }
+
+bool SessionWriter::open(const std::string& path, Anonymize anonymize) {
+  close();
+  file_ = fopen(path.c_str(), "wb");
+  if (!file_) {
+    return false;
+  }
+  failed_ = false;
+  anonymize_ = anonymize;
+  std::random_device random;
+  std::mt19937_64 rng((uint64_t)random() << 32 | random());
+  for (int i = 0; i < 26; ++i) {
+    letters_[i] = 'a' + i;
+  }
+  std::shuffle(letters_, letters_ + 26, rng);
+  salt_ = rng();
+
+  buffer_.append(MAGIC, sizeof(MAGIC));
+  buffer_.append(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+  put_byte(static_cast<uint8_t>(anonymize));
+  return true;
+}
+
+bool SessionWriter::close() {
+  if (!file_) {
+    return !failed_;
+  }
+  flush();
+  if (fclose(file_) != 0) {
+    failed_ = true;
+  }
+  file_ = nullptr;
+  buffer_.clear();
+  buffer_.shrink_to_fit();
+  return !failed_;
+}
+
+void SessionWriter::flush() {
+  if (!buffer_.empty() &&
+      fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) {
+    failed_ = true;
+  }
+  buffer_.clear();
+}
+
+void SessionWriter::put_uint(uint64_t value) {
+  while (value >= 0x80) {
+    put_byte(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  put_byte(static_cast<uint8_t>(value));
+}
+
+// zigzag, so small negative values stay short
+void SessionWriter::put_int(int64_t value) {
+  put_uint((static_cast<uint64_t>(value) << 1) ^
+           static_cast<uint64_t>(value >> 63));
+}
+
+void SessionWriter::put_double(double value) {
+  buffer_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+std::string_view SessionWriter::anonymized(std::string_view s, Field field) {
+  if (anonymize_ == Anonymize::NONE || field == PLAIN || s.empty()) {
+    return s;
+  }
+  if (anonymize_ == Anonymize::HASH) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx",
+             (unsigned long long)FrecencyStore::key(salt_, fnv1a(s)));
+    scratch_ = hex;
+  } else if (field == DETAIL) {
+    scratch_.assign(s.size(), 'x');
+  } else {
+    scratch_.assign(s);
+    for (char& c : scratch_) {
+      if (c >= 'a' && c <= 'z') {
+        c = letters_[c - 'a'];
+      } else if (c >= 'A' && c <= 'Z') {
+        c = letters_[c - 'A'] - 'a' + 'A';
+      }
+    }
+  }
+  return scratch_;
+}
+
+void SessionWriter::put_string(std::string_view s, Field field) {
+  s = anonymized(s, field);
+  put_uint(s.size());
+  buffer_.append(s);
+}
+
+// the length plus one, 0 when there is no string
+void SessionWriter::put_optional(const std::optional<std::string_view>& s,
+                                 Field field) {
+  if (!s) {
+    put_uint(0);
+    return;
+  }
+  std::string_view value = anonymized(*s, field);
+  put_uint(value.size() + 1);
+  buffer_.append(value);
+}
+
+void SessionWriter::insert(const SessionInsert& insert) {
+  if (!file_) {
+    return;
+  }
+  put_byte(static_cast<uint8_t>(SessionOp::INSERT));
+  put_int(insert.client_id);
+  put_int(insert.bufnr);
+  put_int(insert.line);
+  put_int(insert.col);
+  put_uint(insert.items.size());
+  // sort texts only break ties, so their rank among the sort texts of the
+  // call, zero-padded to compare like numbers, orders them the same
+  sort_texts_.clear();
+  if (anonymize_ != Anonymize::NONE) {
+    for (const SessionItem& item : insert.items) {
+      if (item.sort_text) {
+        sort_texts_.push_back(*item.sort_text);
+      }
+    }
+    std::sort(sort_texts_.begin(), sort_texts_.end());
+    sort_texts_.erase(std::unique(sort_texts_.begin(), sort_texts_.end()),
+                      sort_texts_.end());
+  }
+  const int width = std::to_string(sort_texts_.size()).size();
+  for (const SessionItem& item : insert.items) {
+    put_string(item.label, IDENTIFIER);
+    put_optional(item.filter_text, IDENTIFIER);
+    if (anonymize_ == Anonymize::NONE || !item.sort_text) {
+      put_optional(item.sort_text, PLAIN);
+    } else {
+      size_t rank = std::lower_bound(sort_texts_.begin(), sort_texts_.end(),
+                                     *item.sort_text) -
+                    sort_texts_.begin();
+      char token[24];
+      snprintf(token, sizeof(token), "%0*zu", width, rank);
+      put_optional(std::string_view(token), PLAIN);
+    }
+    put_optional(item.insert_text, IDENTIFIER);
+    put_optional(item.detail, DETAIL);
+    put_uint(item.kind ? *item.kind + 1 : 0);
+    put_uint(item.insert_text_format ? *item.insert_text_format + 1 : 0);
+    if (!item.text_edit) {
+      put_byte(0);
+      continue;
+    }
+    const SessionEdit& edit = *item.text_edit;
+    // 0x80 tells an edit without ranges from no edit
+    put_byte(0x80 | edit.ranges);
+    put_string(edit.new_text, IDENTIFIER);
+    for (int r = 0; r < 3; ++r) {
+      if (edit.ranges & RANGE_BITS[r]) {
+        for (int c = 0; c < 4; ++c) {
+          put_int(edit.coords[r][c]);
+        }
+      }
+    }
+  }
+  if (buffer_.size() >= FLUSH_SIZE) {
+    flush();
+  }
+}
+
+void SessionWriter::query(const SessionQuery& query) {
+  if (!file_) {
+    return;
+  }
+  put_byte(static_cast<uint8_t>(SessionOp::QUERY));
+  put_int(query.bufnr);
+  put_int(query.line);
+  put_int(query.col);
+  put_int(query.start);
+  put_int(query.cursor);
+  put_string(query.keyword, IDENTIFIER);
+  put_int(query.insert_cost);
+  put_int(query.delete_cost);
+  put_int(query.substitude_cost);
+  put_int(query.alpha);
+  put_double(query.max_cost);
+  put_double(query.beta);
+  put_double(query.gamma);
+  put_byte(query.kernel);
+  put_int(query.max_results);
+  put_byte(query.lazy);
+  put_int(query.index_threshold);
+  put_string(query.filetype, PLAIN);
+  put_double(query.frecency_boost);
+  put_byte(query.scorer);
+  if (buffer_.size() >= FLUSH_SIZE) {
+    flush();
+  }
+}
+
+void SessionWriter::clear() {
+  if (file_) {
+    put_byte(static_cast<uint8_t>(SessionOp::CLEAR));
+  }
+}
+
+bool SessionReader::open(const std::string& path) {
+  data_.clear();
+  pos_ = 0;
+  error_ = false;
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  char chunk[1 << 16];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    data_.append(chunk, n);
+  }
+  fclose(file);
+
+  uint32_t version = 0;
+  if (data_.size() < sizeof(MAGIC) + sizeof(version) + 1 ||
+      memcmp(data_.data(), MAGIC, sizeof(MAGIC)) != 0) {
+    return false;
+  }
+  memcpy(&version, data_.data() + sizeof(MAGIC), sizeof(version));
+  if (version != VERSION) {
+    return false;
+  }
+  pos_ = sizeof(MAGIC) + sizeof(version);
+  anonymize_ = static_cast<Anonymize>(data_[pos_++]);
+  return true;
+}
+
+bool SessionReader::get_byte(uint8_t& byte) {
+  if (pos_ >= data_.size()) {
+    return false;
+  }
+  byte = data_[pos_++];
+  return true;
+}
+
+bool SessionReader::get_uint(uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    uint8_t byte;
+    if (!get_byte(byte)) {
+      return false;
+    }
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SessionReader::get_int(int& value) {
+  uint64_t zigzag;
+  if (!get_uint(zigzag)) {
+    return false;
+  }
+  value = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+  return true;
+}
+
+bool SessionReader::get_double(double& value) {
+  if (data_.size() - pos_ < sizeof(value)) {
+    return false;
+  }
+  memcpy(&value, data_.data() + pos_, sizeof(value));
+  pos_ += sizeof(value);
+  return true;
+}
+
+bool SessionReader::get_string(std::string_view& s) {
+  uint64_t length;
+  if (!get_uint(length) || data_.size() - pos_ < length) {
+    return false;
+  }
+  s = std::string_view(data_.data() + pos_, length);
+  pos_ += length;
+  return true;
+}
+
+bool SessionReader::get_optional(std::optional<std::string_view>& s) {
+  uint64_t length;
+  if (!get_uint(length)) {
+    return false;
+  }
+  if (length == 0) {
+    s.reset();
+    return true;
+  }
+  length--;
+  if (data_.size() - pos_ < length) {
+    return false;
+  }
+  s = std::string_view(data_.data() + pos_, length);
+  pos_ += length;
+  return true;
+}
+
+bool SessionReader::get_item(SessionItem& item) {
+  uint64_t kind;
+  uint64_t format;
+  uint8_t ranges;
+  if (!get_string(item.label) || !get_optional(item.filter_text) ||
+      !get_optional(item.sort_text) || !get_optional(item.insert_text) ||
+      !get_optional(item.detail) || !get_uint(kind) || !get_uint(format) ||
+      !get_byte(ranges)) {
+    return false;
+  }
+  item.kind = kind > 0 ? std::optional<int>(kind - 1) : std::nullopt;
+  item.insert_text_format =
+      format > 0 ? std::optional<int>(format - 1) : std::nullopt;
+  item.text_edit.reset();
+  if (!(ranges & 0x80)) {
+    return true;
+  }
+  SessionEdit& edit = item.text_edit.emplace();
+  edit.ranges = ranges & 0x7f;
+  if (!get_string(edit.new_text)) {
+    return false;
+  }
+  for (int r = 0; r < 3; ++r) {
+    if (edit.ranges & RANGE_BITS[r]) {
+      for (int c = 0; c < 4; ++c) {
+        if (!get_int(edit.coords[r][c])) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool SessionReader::next(SessionOp& op, SessionInsert& insert,
+                         SessionQuery& query) {
+  uint8_t byte;
+  if (!get_byte(byte)) {
+    return false;
+  }
+  op = static_cast<SessionOp>(byte);
+  bool ok = false;
+  switch (op) {
+    case SessionOp::INSERT: {
+      uint64_t count;
+      ok = get_int(insert.client_id) && get_int(insert.bufnr) &&
+           get_int(insert.line) && get_int(insert.col) && get_uint(count) &&
+           count <= data_.size() - pos_;
+      if (ok) {
+        insert.items.resize(count);
+        for (SessionItem& item : insert.items) {
+          if (!get_item(item)) {
+            ok = false;
+            break;
+          }
+        }
+      }
+      break;
+    }
+    case SessionOp::QUERY: {
+      uint8_t lazy = 0;
+      ok = get_int(query.bufnr) && get_int(query.line) &&
+           get_int(query.col) && get_int(query.start) &&
+           get_int(query.cursor) && get_string(query.keyword) &&
+           get_int(query.insert_cost) && get_int(query.delete_cost) &&
+           get_int(query.substitude_cost) && get_int(query.alpha) &&
+           get_double(query.max_cost) && get_double(query.beta) &&
+           get_double(query.gamma) && get_byte(query.kernel) &&
+           get_int(query.max_results) && get_byte(lazy) &&
+           get_int(query.index_threshold) && get_string(query.filetype) &&
+           get_double(query.frecency_boost) && get_byte(query.scorer);
+      query.lazy = lazy;
+      break;
+    }
+    case SessionOp::CLEAR:
+      ok = true;
+      break;
+  }
+  error_ = !ok;
+  return ok;
+}
@@ -0,0 +1,167 @@
+#ifndef SESSION_LOG_H
+#define SESSION_LOG_H
+
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// What a recorded session keeps of the strings, the lengths are kept by all.
+enum class Anonymize : uint8_t {
+  NONE = 0,
+  // Letters go through one random permutation per recording, lowercase and
+  // uppercase alike, details are blanked and sort texts become their rank
+  // among the sort texts of their insert call. Every match and edit distance
+  // stays what it was, so replays score the same, and ties sorted by sort
+  // text within a call stay in order; ties sorted by label may not. This is
+  // a monoalphabetic substitution: letter frequencies and word shapes remain
+  // and a few identifiers are enough to undo it by hand, so it keeps names
+  // from a casual look and is no anonymization.
+  SCRAMBLE = 1,
+  // every string becomes a salted hash and sort texts their rank as with
+  // SCRAMBLE, replays then no longer match like the session did
+  HASH = 2,
+};
+
+enum class SessionOp : uint8_t {
+  INSERT = 1,
+  QUERY = 2,
+  CLEAR = 3,
+};
+
+struct SessionEdit {
+  std::string_view new_text;
+  // TextEditRange bits, and the start line, start character, end line and
+  // end character of each range present in the order range, insert, replace
+  uint8_t ranges = 0;
+  int coords[3][4] = {};
+};
+
+// One item of an insert_items call. The strings point into the items of the
+// call when writing and into the file when reading.
+struct SessionItem {
+  std::string_view label;
+  std::optional<std::string_view> filter_text;
+  std::optional<std::string_view> sort_text;
+  std::optional<std::string_view> insert_text;
+  std::optional<std::string_view> detail;
+  std::optional<int> kind;
+  std::optional<int> insert_text_format;
+  std::optional<SessionEdit> text_edit;
+};
+
+struct SessionInsert {
+  int client_id;
+  int bufnr;
+  int line;
+  int col;
+  std::vector<SessionItem> items;
+};
+
+// a get_completion_items call with the fields of its edit distance option
+struct SessionQuery {
+  int bufnr;
+  int line;
+  int col;
+  int start;
+  int cursor;
+  std::string_view keyword;
+  int insert_cost;
+  int delete_cost;
+  int substitude_cost;
+  int alpha;
+  double max_cost;
+  double beta;
+  double gamma;
+  // an EditDistanceKernel
+  uint8_t kernel;
+  int max_results;
+  bool lazy;
+  int index_threshold;
+  std::string_view filetype;
+  double frecency_boost;
+  // a Scorer
+  uint8_t scorer;
+};
+
+// Appends the calls of a session to a file in a compact varint encoding,
+// for paw_replay. Writes are buffered and go out on close().
+class SessionWriter {
+ public:
+  SessionWriter() = default;
+  ~SessionWriter();
+
+  SessionWriter(const SessionWriter&) = delete;
+  SessionWriter& operator=(const SessionWriter&) = delete;
+
+  // false when path cannot be created
+  bool open(const std::string& path, Anonymize anonymize);
+  // false when a write failed since open
+  bool close();
+  bool is_open() const { return file_ != nullptr; }
+
+  void insert(const SessionInsert& insert);
+  void query(const SessionQuery& query);
+  void clear();
+
+ private:
+  void put_byte(uint8_t byte) { buffer_.push_back(byte); }
+  void put_uint(uint64_t value);
+  void put_int(int64_t value);
+  void put_double(double value);
+
+  // how anonymize_ treats a string
+  enum Field {
+    PLAIN,
+    // matched against the keyword
+    IDENTIFIER,
+    // only shown
+    DETAIL,
+  };
+  // s as anonymize_ keeps it, may point into scratch_
+  std::string_view anonymized(std::string_view s, Field field);
+  void put_string(std::string_view s, Field field);
+  void put_optional(const std::optional<std::string_view>& s, Field field);
+  void flush();
+
+  FILE* file_ = nullptr;
+  bool failed_ = false;
+  Anonymize anonymize_ = Anonymize::NONE;
+  std::string buffer_;
+  std::string scratch_;
+  // the distinct sort texts of the insert call being written, sorted
+  std::vector<std::string_view> sort_texts_;
+  // the letter permutation of SCRAMBLE, or the salt of HASH
+  char letters_[26];
+  uint64_t salt_ = 0;
+};
+
+// Reads a file of SessionWriter back one call at a time.
+class SessionReader {
+ public:
+  // false when path cannot be read or is not a session file
+  bool open(const std::string& path);
+  Anonymize anonymize() const { return anonymize_; }
+
+  // false at the end of the file, or when it is cut short, see error()
+  bool next(SessionOp& op, SessionInsert& insert, SessionQuery& query);
+  bool error() const { return error_; }
+
+ private:
+  bool get_byte(uint8_t& byte);
+  bool get_uint(uint64_t& value);
+  bool get_int(int& value);
+  bool get_double(double& value);
+  bool get_string(std::string_view& s);
+  bool get_optional(std::optional<std::string_view>& s);
+  bool get_item(SessionItem& item);
+
+  std::string data_;
+  size_t pos_ = 0;
+  bool error_ = false;
+  Anonymize anonymize_ = Anonymize::NONE;
+};
+
+#endif /* end of include guard: SESSION_LOG_H */
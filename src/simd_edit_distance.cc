@@ -0,0 +1,322 @@
+#include <algorithm>
+
+#include "edit_distance.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PAW_X86
+#endif
+
+namespace {
+
+// longest text put in a lane, together with the weights this keeps every
+// cell inside int16_t
+constexpr int MAX_LANE_LENGTH = 512;
+
+struct DpWeights {
+  int insert_cost;
+  int delete_cost;
+  int substitude_cost;
+  int alpha;
+};
+
+// weights the kernels below are compiled for, the costs fold into constants
+template <int INSERT, int DELETE, int SUBSTITUDE>
+struct FixedWeights {
+  static constexpr int insert_cost = INSERT;
+  static constexpr int delete_cost = DELETE;
+  static constexpr int substitude_cost = SUBSTITUDE;
+  int alpha;
+};
+
+// the dp of edit_distance() in paw.cc on a lowercased text
+template <typename Weights>
+int scalar_distance(std::string_view s1, std::string_view s2,
+                    const Weights& w, std::vector<int>& dp,
+                    std::vector<int>& next_dp) {
+  const size_t len1 = s1.length();
+  const size_t len2 = s2.length();
+  dp.resize(len2 + 1);
+  next_dp.resize(len2 + 1);
+  for (size_t j = 0; j <= len2; ++j) {
+    dp[j] = j * w.insert_cost;
+  }
+  for (size_t i = 1; i <= len1; ++i) {
+    next_dp[0] = i * w.delete_cost;
+    for (size_t j = 1; j <= len2; ++j) {
+      // alpha only drops on the last cell when both lengths are equal
+      int weight = (i == len1 && j == len2 && len1 == len2) ? 0 : w.alpha;
+      if (s1[i - 1] == s2[j - 1]) {
+        next_dp[j] = dp[j - 1];
+      } else {
+        next_dp[j] = std::min({dp[j] + w.delete_cost + weight,
+                               next_dp[j - 1] + w.insert_cost + weight,
+                               dp[j - 1] + w.substitude_cost + weight});
+      }
+    }
+    std::swap(dp, next_dp);
+  }
+  return dp[len2];
+}
+
+#ifdef PAW_X86
+
+// One text per lane. Lanes are filled column by column from the packed texts
+// and a lane stops updating once its text runs out.
+template <typename Weights>
+__attribute__((target("avx2"))) void avx2_distance(
+    const PackedTexts& texts, const uint32_t* index, int count,
+    std::string_view keyword, const Weights& w, int16_t* columns,
+    int16_t* dp, int* out) {
+  constexpr int LANES = 16;
+  alignas(32) int16_t lengths[LANES] = {0};
+  int max_length = 0;
+  for (int l = 0; l < count; ++l) {
+    std::string_view text = texts.text(index[l]);
+    lengths[l] = text.length();
+    max_length = std::max<int>(max_length, text.length());
+    for (size_t i = 0; i < text.length(); ++i) {
+      columns[i * LANES + l] = static_cast<unsigned char>(text[i]);
+    }
+  }
+
+  const int m = keyword.length();
+  const __m256i length = _mm256_load_si256((const __m256i*)lengths);
+  const __m256i ins = _mm256_set1_epi16(w.insert_cost + w.alpha);
+  const __m256i del = _mm256_set1_epi16(w.delete_cost + w.alpha);
+  const __m256i sub = _mm256_set1_epi16(w.substitude_cost + w.alpha);
+  const __m256i same = _mm256_cmpeq_epi16(length, _mm256_set1_epi16(m));
+  const __m256i last_ins =
+      _mm256_blendv_epi8(ins, _mm256_set1_epi16(w.insert_cost), same);
+  const __m256i last_del =
+      _mm256_blendv_epi8(del, _mm256_set1_epi16(w.delete_cost), same);
+  const __m256i last_sub =
+      _mm256_blendv_epi8(sub, _mm256_set1_epi16(w.substitude_cost), same);
+
+  __m256i* row = reinterpret_cast<__m256i*>(dp);
+  for (int j = 0; j <= m; ++j) {
+    _mm256_storeu_si256(row + j, _mm256_set1_epi16(j * w.insert_cost));
+  }
+
+  for (int i = 1; i <= max_length; ++i) {
+    const __m256i active = _mm256_cmpgt_epi16(length, _mm256_set1_epi16(i - 1));
+    const __m256i c =
+        _mm256_loadu_si256((const __m256i*)(columns + (i - 1) * LANES));
+    __m256i diag = _mm256_loadu_si256(row);
+    __m256i left = _mm256_set1_epi16(i * w.delete_cost);
+    _mm256_storeu_si256(row, _mm256_blendv_epi8(diag, left, active));
+    for (int j = 1; j <= m; ++j) {
+      const bool last = i == m && j == m;
+      const __m256i up = _mm256_loadu_si256(row + j);
+      const __m256i eq = _mm256_cmpeq_epi16(
+          c, _mm256_set1_epi16(static_cast<unsigned char>(keyword[j - 1])));
+      __m256i cost = _mm256_min_epi16(
+          _mm256_adds_epi16(up, last ? last_del : del),
+          _mm256_adds_epi16(left, last ? last_ins : ins));
+      cost = _mm256_min_epi16(cost,
+                              _mm256_adds_epi16(diag, last ? last_sub : sub));
+      cost = _mm256_blendv_epi8(cost, diag, eq);
+      cost = _mm256_blendv_epi8(up, cost, active);
+      _mm256_storeu_si256(row + j, cost);
+      left = cost;
+      diag = up;
+    }
+  }
+
+  alignas(32) int16_t result[LANES];
+  _mm256_store_si256((__m256i*)result, _mm256_loadu_si256(row + m));
+  for (int l = 0; l < count; ++l) {
+    out[l] = result[l];
+  }
+}
+
+template <typename Weights>
+__attribute__((target("sse4.2"))) void sse42_distance(
+    const PackedTexts& texts, const uint32_t* index, int count,
+    std::string_view keyword, const Weights& w, int16_t* columns,
+    int16_t* dp, int* out) {
+  constexpr int LANES = 8;
+  alignas(16) int16_t lengths[LANES] = {0};
+  int max_length = 0;
+  for (int l = 0; l < count; ++l) {
+    std::string_view text = texts.text(index[l]);
+    lengths[l] = text.length();
+    max_length = std::max<int>(max_length, text.length());
+    for (size_t i = 0; i < text.length(); ++i) {
+      columns[i * LANES + l] = static_cast<unsigned char>(text[i]);
+    }
+  }
+
+  const int m = keyword.length();
+  const __m128i length = _mm_load_si128((const __m128i*)lengths);
+  const __m128i ins = _mm_set1_epi16(w.insert_cost + w.alpha);
+  const __m128i del = _mm_set1_epi16(w.delete_cost + w.alpha);
+  const __m128i sub = _mm_set1_epi16(w.substitude_cost + w.alpha);
+  const __m128i same = _mm_cmpeq_epi16(length, _mm_set1_epi16(m));
+  const __m128i last_ins =
+      _mm_blendv_epi8(ins, _mm_set1_epi16(w.insert_cost), same);
+  const __m128i last_del =
+      _mm_blendv_epi8(del, _mm_set1_epi16(w.delete_cost), same);
+  const __m128i last_sub =
+      _mm_blendv_epi8(sub, _mm_set1_epi16(w.substitude_cost), same);
+
+  __m128i* row = reinterpret_cast<__m128i*>(dp);
+  for (int j = 0; j <= m; ++j) {
+    _mm_storeu_si128(row + j, _mm_set1_epi16(j * w.insert_cost));
+  }
+
+  for (int i = 1; i <= max_length; ++i) {
+    const __m128i active = _mm_cmpgt_epi16(length, _mm_set1_epi16(i - 1));
+    const __m128i c =
+        _mm_loadu_si128((const __m128i*)(columns + (i - 1) * LANES));
+    __m128i diag = _mm_loadu_si128(row);
+    __m128i left = _mm_set1_epi16(i * w.delete_cost);
+    _mm_storeu_si128(row, _mm_blendv_epi8(diag, left, active));
+    for (int j = 1; j <= m; ++j) {
+      const bool last = i == m && j == m;
+      const __m128i up = _mm_loadu_si128(row + j);
+      const __m128i eq = _mm_cmpeq_epi16(
+          c, _mm_set1_epi16(static_cast<unsigned char>(keyword[j - 1])));
+      __m128i cost =
+          _mm_min_epi16(_mm_adds_epi16(up, last ? last_del : del),
+                        _mm_adds_epi16(left, last ? last_ins : ins));
+      cost = _mm_min_epi16(cost, _mm_adds_epi16(diag, last ? last_sub : sub));
+      cost = _mm_blendv_epi8(cost, diag, eq);
+      cost = _mm_blendv_epi8(up, cost, active);
+      _mm_storeu_si128(row + j, cost);
+      left = cost;
+      diag = up;
+    }
+  }
+
+  alignas(16) int16_t result[LANES];
+  _mm_store_si128((__m128i*)result, _mm_loadu_si128(row + m));
+  for (int l = 0; l < count; ++l) {
+    out[l] = result[l];
+  }
+}
+
+#endif
+
+template <typename Weights>
+void batch_distance(const PackedTexts& texts, const uint32_t* order,
+                    size_t count, const std::string& lower_keyword,
+                    const Weights& w, int* distances, SimdLevel level) {
+  const int m = lower_keyword.length();
+
+  // every cell stays below (length + m) * heaviest step
+  int heaviest =
+      std::max({w.insert_cost, w.delete_cost, w.substitude_cost}) +
+      std::max(w.alpha, 0);
+  bool fits = std::min<int>({w.insert_cost, w.delete_cost, w.substitude_cost,
+                             w.alpha}) >= 0 &&
+              (int64_t)(MAX_LANE_LENGTH + m) * heaviest < INT16_MAX;
+  int lanes = 1;
+#ifdef PAW_X86
+  if (fits && level == AVX2) {
+    lanes = 16;
+  } else if (fits && level == SSE42) {
+    lanes = 8;
+  }
+#endif
+
+  std::vector<int> dp;
+  std::vector<int> next_dp;
+  size_t start = 0;
+  if (lanes > 1) {
+    std::vector<int16_t> columns(MAX_LANE_LENGTH * lanes);
+    std::vector<int16_t> row((m + 1) * lanes);
+    int out[16];
+    // order is sorted, so everything from the first text longer than a
+    // lane is left to the scalar loop below
+    while (start < count && texts.lengths[order[start]] <= MAX_LANE_LENGTH) {
+      int lane_count = 0;
+      while (lane_count < lanes && start + lane_count < count &&
+             texts.lengths[order[start + lane_count]] <= MAX_LANE_LENGTH) {
+        lane_count++;
+      }
+#ifdef PAW_X86
+      if (lanes == 16) {
+        avx2_distance(texts, &order[start], lane_count, lower_keyword, w,
+                      columns.data(), row.data(), out);
+      } else {
+        sse42_distance(texts, &order[start], lane_count, lower_keyword, w,
+                       columns.data(), row.data(), out);
+      }
+#endif
+      for (int l = 0; l < lane_count; ++l) {
+        distances[order[start + l]] = out[l];
+      }
+      start += lane_count;
+    }
+  }
+
+  for (; start < count; ++start) {
+    distances[order[start]] =
+        scalar_distance(texts.text(order[start]), lower_keyword, w, dp, next_dp);
+  }
+}
+
+template <int INSERT, int DELETE, int SUBSTITUDE>
+void fixed_batch_distance(const PackedTexts& texts, const uint32_t* order,
+                          size_t count, const std::string& lower_keyword, int,
+                          int, int, int alpha, int* distances,
+                          SimdLevel level) {
+  batch_distance(texts, order, count, lower_keyword,
+                 FixedWeights<INSERT, DELETE, SUBSTITUDE>{alpha}, distances,
+                 level);
+}
+
+void runtime_batch_distance(const PackedTexts& texts, const uint32_t* order,
+                            size_t count, const std::string& lower_keyword,
+                            int insert_cost, int delete_cost,
+                            int substitude_cost, int alpha, int* distances,
+                            SimdLevel level) {
+  batch_distance(texts, order, count, lower_keyword,
+                 DpWeights{insert_cost, delete_cost, substitude_cost, alpha},
+                 distances, level);
+}
+
+}  // namespace
+
+SimdLevel detect_simd_level() {
+#ifdef PAW_X86
+  static const SimdLevel level = __builtin_cpu_supports("avx2")     ? AVX2
+                                 : __builtin_cpu_supports("sse4.2") ? SSE42
+                                                                    : SCALAR;
+  return level;
+#else
+  return SCALAR;
+#endif
+}
+
+void batch_edit_distance(const PackedTexts& texts,
+                         const std::vector<uint32_t>& order,
+                         const std::string& keyword, int insert_cost,
+                         int delete_cost, int substitude_cost, int alpha,
+                         std::vector<int>& distances, SimdLevel level) {
+  distances.resize(texts.size());
+  batch_edit_distance(texts, order.data(), order.size(), keyword, insert_cost,
+                      delete_cost, substitude_cost, alpha, distances.data(),
+                      level);
+}
+
+void batch_edit_distance(const PackedTexts& texts, const uint32_t* order,
+                         size_t count, const std::string& keyword,
+                         int insert_cost, int delete_cost, int substitude_cost,
+                         int alpha, int* distances, SimdLevel level) {
+  select_batch_distance(insert_cost, delete_cost, substitude_cost)(
+      texts, order, count, to_lower(keyword), insert_cost, delete_cost,
+      substitude_cost, alpha, distances, level);
+}
+
+BatchDistance select_batch_distance(int insert_cost, int delete_cost,
+                                    int substitude_cost) {
+  if (insert_cost == 1 && delete_cost == 1 && substitude_cost == 2) {
+    return fixed_batch_distance<1, 1, 2>;
+  }
+  if (insert_cost == 1 && delete_cost == 1 && substitude_cost == 1) {
+    return fixed_batch_distance<1, 1, 1>;
+  }
+  return runtime_batch_distance;
+}
@@ -0,0 +1,96 @@
+#ifndef STRING_ARENA_H
+#define STRING_ARENA_H
+
+#include <absl/container/flat_hash_map.h>
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+
+// An optional string inside a StringArena. It is kept as offset and length
+// instead of a pointer so it stays valid while the arena grows.
+struct StringRef {
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  uint32_t offset = NONE;
+  uint32_t length = 0;
+
+  bool has_value() const { return offset != NONE; }
+};
+
+// Every string of one completion list, stored back to back in one buffer.
+// Freeing the list frees all of them at once.
+class StringArena {
+ public:
+  StringRef add(std::string_view s) {
+    StringRef ref{static_cast<uint32_t>(buffer_.length()),
+                  static_cast<uint32_t>(s.length())};
+    buffer_.append(s);
+    return ref;
+  }
+
+  // a missing string reads as empty
+  std::string_view get(StringRef ref) const {
+    if (!ref.has_value()) {
+      return std::string_view();
+    }
+    return std::string_view(buffer_.data() + ref.offset, ref.length);
+  }
+
+  // appends every string of other, a StringRef into other moves by the
+  // offset returned
+  uint32_t append(const StringArena& other) {
+    uint32_t offset = buffer_.length();
+    buffer_.append(other.buffer_);
+    return offset;
+  }
+
+  size_t bytes() const { return buffer_.capacity(); }
+
+  void clear() { buffer_.clear(); }
+
+ private:
+  std::string buffer_;
+};
+
+// Strings repeated across responses and clients, like the "std::string" or
+// module name details, stored once. An id stays valid until clear().
+class InternPool {
+ public:
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  uint32_t intern(std::string_view s) {
+    auto it = ids_.find(s);
+    if (it != ids_.end()) {
+      return it->second;
+    }
+    uint32_t id = strings_.size();
+    strings_.emplace_back(s);
+    ids_.emplace(strings_.back(), id);
+    bytes_ += sizeof(std::string) + s.length() +
+              sizeof(std::pair<std::string_view, uint32_t>);
+    return id;
+  }
+
+  const std::string& get(uint32_t id) const { return strings_[id]; }
+
+  size_t size() const { return strings_.size(); }
+
+  // approximate heap bytes held
+  size_t bytes() const { return bytes_; }
+
+  void clear() {
+    ids_.clear();
+    strings_.clear();
+    bytes_ = 0;
+  }
+
+ private:
+  // a deque never moves its strings, so the views in ids_ stay valid
+  std::deque<std::string> strings_;
+  absl::flat_hash_map<std::string_view, uint32_t> ids_;
+  size_t bytes_ = 0;
+};
+
+#endif /* end of include guard: STRING_ARENA_H */
@@ -0,0 +1,128 @@
+#include "trace.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+
+namespace {
+
+// small ids in the order threads first trace, the editor thread is usually 1
+uint32_t thread_id() {
+  static std::atomic<uint32_t> next{1};
+  thread_local uint32_t id = next.fetch_add(1);
+  return id;
+}
+
+double to_us(Tracer::Clock::time_point t) {
+  return std::chrono::duration<double, std::micro>(t.time_since_epoch())
+      .count();
+}
+
+void write_json_string(FILE* file, std::string_view s) {
+  fputc('"', file);
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      fputc('\\', file);
+      fputc(c, file);
+    } else if (c < 0x20) {
+      fprintf(file, "\\u%04x", c);
+    } else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+}  // namespace
+
+void Tracer::enable(size_t capacity) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  spans_.clear();
+  spans_.shrink_to_fit();
+  spans_.reserve(capacity);
+  capacity_ = capacity;
+  next_ = 0;
+  enabled_.store(capacity > 0, std::memory_order_relaxed);
+}
+
+void Tracer::disable() { enabled_.store(false, std::memory_order_relaxed); }
+
+void Tracer::span(std::string_view name, Clock::time_point start,
+                  Clock::time_point end, int bufnr, int client_id,
+                  int64_t items) {
+  if (!enabled()) {
+    return;
+  }
+  const char* interned;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = names_.find(name);
+    if (it == names_.end()) {
+      it = names_.emplace(name).first;
+    }
+    interned = it->c_str();
+  }
+  add(interned, start, end, bufnr, client_id, items);
+}
+
+void Tracer::add(const char* name, Clock::time_point start,
+                 Clock::time_point end, int bufnr, int client_id,
+                 int64_t items) {
+  uint64_t ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  Span span{name, start, ns, thread_id(), bufnr, client_id, items};
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (spans_.size() < capacity_) {
+    spans_.push_back(span);
+    return;
+  }
+  if (capacity_ == 0) {
+    return;
+  }
+  spans_[next_] = span;
+  next_ = (next_ + 1) % capacity_;
+}
+
+std::vector<Tracer::Span> Tracer::spans() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<Span> spans;
+  spans.reserve(spans_.size());
+  spans.insert(spans.end(), spans_.begin() + next_, spans_.end());
+  spans.insert(spans.end(), spans_.begin(), spans_.begin() + next_);
+  return spans;
+}
+
+bool Tracer::dump(const std::string& path) const {
+  std::vector<Span> spans = this->spans();
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file) {
+    return false;
+  }
+  const int pid = getpid();
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+  for (size_t i = 0; i < spans.size(); ++i) {
+    const Span& span = spans[i];
+    fputs(i == 0 ? "\n{\"name\":" : ",\n{\"name\":", file);
+    write_json_string(file, span.name);
+    fprintf(file,
+            ",\"cat\":\"paw\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%d,\"tid\":%u,\"args\":{",
+            to_us(span.start), span.duration_ns / 1e3, pid, span.tid);
+    const char* separator = "";
+    if (span.bufnr != NONE) {
+      fprintf(file, "\"bufnr\":%d", span.bufnr);
+      separator = ",";
+    }
+    if (span.client_id != NONE) {
+      fprintf(file, "%s\"client_id\":%d", separator, span.client_id);
+      separator = ",";
+    }
+    if (span.items != NONE) {
+      fprintf(file, "%s\"items\":%lld", separator, (long long)span.items);
+    }
+    fputs("}}", file);
+  }
+  fputs("\n]}\n", file);
+  bool ok = !ferror(file);
+  return fclose(file) == 0 && ok;
+}
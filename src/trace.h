@@ -0,0 +1,74 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Keeps the last spans of the completion pipeline in a ring buffer while it
+// is enabled, for dump() to write as chrome trace events. Disabled, a span
+// costs one relaxed load. Spans can come from any thread.
+class Tracer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // a bufnr, client id or item count the span does not have
+  static constexpr int NONE = INT_MIN;
+  static constexpr size_t DEFAULT_CAPACITY = 65536;
+
+  struct Span {
+    const char* name;
+    Clock::time_point start;
+    uint64_t duration_ns;
+    uint32_t tid;
+    int bufnr;
+    int client_id;
+    int64_t items;
+  };
+
+  // drops the spans kept so far and keeps the last capacity from now on
+  void enable(size_t capacity = DEFAULT_CAPACITY);
+  void disable();
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  // name must outlive the tracer, a string literal
+  void span(const char* name, Clock::time_point start, Clock::time_point end,
+            int bufnr = NONE, int client_id = NONE, int64_t items = NONE) {
+    if (enabled()) {
+      add(name, start, end, bufnr, client_id, items);
+    }
+  }
+
+  // for names that come from lua, they are copied once
+  void span(std::string_view name, Clock::time_point start,
+            Clock::time_point end, int bufnr = NONE, int client_id = NONE,
+            int64_t items = NONE);
+
+  // the spans kept, oldest first
+  std::vector<Span> spans() const;
+
+  // writes spans() as a chrome trace event json that perfetto and
+  // chrome://tracing open, false when path cannot be written
+  bool dump(const std::string& path) const;
+
+ private:
+  void add(const char* name, Clock::time_point start, Clock::time_point end,
+           int bufnr, int client_id, int64_t items);
+
+  std::atomic<bool> enabled_{false};
+  mutable std::mutex mutex_;
+  std::vector<Span> spans_;
+  // where the next span goes once spans_ is full
+  size_t next_ = 0;
+  size_t capacity_ = 0;
+  // names of the spans from lua, a set keeps their c_str() in place
+  std::set<std::string, std::less<>> names_;
+};
+
+#endif /* end of include guard: TRACE_H */
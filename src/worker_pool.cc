@@ -0,0 +1,79 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(size_t threads) {
+  for (size_t i = 1; i < threads; ++i) {
+    workers_.emplace_back(&WorkerPool::run, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+size_t WorkerPool::default_size() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void WorkerPool::parallel_for(size_t n, size_t chunk,
+                              const std::function<void(size_t, size_t)>& fn) {
+  chunk = std::max<size_t>(chunk, 1);
+  if (workers_.empty() || n <= chunk) {
+    fn(0, n);
+    return;
+  }
+
+  std::lock_guard<std::mutex> run_lock(run_mutex_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fn_ = &fn;
+    n_ = n;
+    chunk_ = chunk;
+    next_ = 0;
+    active_ = workers_.size();
+    job_++;
+  }
+  wake_.notify_all();
+  work();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // a worker still reads fn_ until it leaves the job
+  done_.wait(lock, [this] { return active_ == 0; });
+  fn_ = nullptr;
+}
+
+void WorkerPool::run() {
+  uint64_t seen = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    wake_.wait(lock, [&] { return stop_ || job_ != seen; });
+    if (stop_) {
+      return;
+    }
+    seen = job_;
+    lock.unlock();
+    work();
+    lock.lock();
+    if (--active_ == 0) {
+      done_.notify_one();
+    }
+  }
+}
+
+void WorkerPool::work() {
+  while (true) {
+    size_t begin = next_.fetch_add(chunk_);
+    if (begin >= n_) {
+      return;
+    }
+    (*fn_)(begin, std::min(begin + chunk_, n_));
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that run the chunks of one parallel_for() at a time.
+// The calling thread takes chunks too, so a pool of size() 1 has no workers
+// and runs everything inline.
+class WorkerPool {
+ public:
+  explicit WorkerPool(size_t threads);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  size_t size() const { return workers_.size() + 1; }
+
+  // Calls fn(begin, end) over [0, n) in chunks of chunk and returns once
+  // every chunk ran. Chunks run in no particular order.
+  void parallel_for(size_t n, size_t chunk,
+                    const std::function<void(size_t, size_t)>& fn);
+
+  // hardware_concurrency, or 1 when it is unknown
+  static size_t default_size();
+
+ private:
+  void run();
+  void work();
+
+  std::vector<std::thread> workers_;
+  // one parallel_for at a time
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  const std::function<void(size_t, size_t)>* fn_ = nullptr;
+  size_t n_ = 0;
+  size_t chunk_ = 0;
+  std::atomic<size_t> next_{0};
+  // workers still in the current job
+  size_t active_ = 0;
+  uint64_t job_ = 0;
+  bool stop_ = false;
+};
+
+#endif /* end of include guard: WORKER_POOL_H */
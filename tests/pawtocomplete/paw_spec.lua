@@ -216,6 +216,872 @@ describe('paw', function()
     assert(item.textEdit.range['end'].character == 2)
   end)
 
+  it('edit distance kernels', function()
+    local completion_items = {}
+    for i = 1, 500 do
+      table.insert(completion_items, { label = generate_random_string(math.random(1, 30)), kind = 1 })
+    end
+    paw.insert_items(completion_items, 1, 2, 1, 10)
+
+    for _, costs in ipairs({ { 1, 1, 2 }, { 1, 1, 1 }, { 2, 3, 1 } }) do
+      for _, keyword in ipairs({ '', 'a', 'Ab', 'x1', string.rep('aB', 40) }) do
+        local option = {
+          keyword = keyword,
+          insert_cost = costs[1],
+          delete_cost = costs[2],
+          substitude_cost = costs[3],
+          kernel = 'dp',
+        }
+        local expected = paw.get_completion_items(2, 1, 10, 1, option)
+        for _, kernel in ipairs({ 'bit_parallel', 'simd', 'auto' }) do
+          option.kernel = kernel
+          local output = paw.get_completion_items(2, 1, 10, 1, option)
+          assert(#output == #expected)
+          for i = 1, #output do
+            assert(output[i].label == expected[i].label)
+            assert(output[i].cost == expected[i].cost)
+          end
+        end
+      end
+    end
+  end)
+
+  it('fzf scorer', function()
+    local completion_items = {}
+    for i = 1, 500 do
+      table.insert(completion_items, { label = generate_random_string(math.random(1, 30)), kind = 1 })
+    end
+    for _, label in ipairs({ 'getFooBar', 'get_foo_bar', 'gxfxb', 'digestfb' }) do
+      table.insert(completion_items, { label = label, kind = 1 })
+    end
+    paw.insert_items(completion_items, 1, 2, 1, 13)
+
+    local option = { keyword = 'gfb', scorer = 'fzf', max_results = 0 }
+    local output = paw.get_completion_items(2, 1, 13, 1, option)
+    -- word starts and humps beat letters in the middle of words
+    local rank = {}
+    for i, item in ipairs(output) do
+      rank[item.label] = i
+      assert(item.cost >= 0 and item.cost <= 5)
+    end
+    assert(rank['getFooBar'] < rank['gxfxb'])
+    assert(rank['get_foo_bar'] < rank['digestfb'])
+    assert(output[1].cost == 0)
+
+    for _, keyword in ipairs({ 'a', 'Ab', 'x1', string.rep('aB', 40) }) do
+      option = { keyword = keyword, scorer = 'fzf', kernel = 'dp', max_results = 0 }
+      local expected = paw.get_completion_items(2, 1, 13, 1, option)
+      option.kernel = 'simd'
+      output = paw.get_completion_items(2, 1, 13, 1, option)
+      assert(#output == #expected)
+      for i = 1, #output do
+        assert(output[i].label == expected[i].label)
+        assert(output[i].cost == expected[i].cost)
+      end
+    end
+  end)
+
+  it('create_profile', function()
+    local completion_items = {}
+    for i = 1, 500 do
+      table.insert(completion_items, { label = generate_random_string(math.random(1, 30)), kind = 1 })
+    end
+    paw.insert_items(completion_items, 1, 2, 1, 14)
+
+    for _, costs in ipairs({ { 1, 1, 2 }, { 1, 1, 1 }, { 2, 3, 1 } }) do
+      local option = {
+        insert_cost = costs[1],
+        delete_cost = costs[2],
+        substitude_cost = costs[3],
+        max_results = 0,
+      }
+      local profile = paw.create_profile(option)
+      for _, keyword in ipairs({ '', 'a', 'Ab', 'x1y' }) do
+        option.keyword = keyword
+        local expected = paw.get_completion_items(2, 1, 14, 1, option)
+        local output = paw.get_completion_items(2, 1, 14, 1, profile, 14, keyword)
+        assert(#output == #expected)
+        for i = 1, #output do
+          assert(output[i].label == expected[i].label)
+          assert(output[i].cost == expected[i].cost)
+        end
+      end
+    end
+
+    assert(not pcall(paw.create_profile, { insert_cost = -1, delete_cost = 1, substitude_cost = 1 }))
+    assert(not pcall(paw.create_profile, { insert_cost = 1, delete_cost = 1, substitude_cost = 1, kernel = 'gpu' }))
+    assert(not pcall(paw.create_profile, { scorer = 'bm25' }))
+    assert(not pcall(paw.get_completion_items, 2, 1, 14, 1, paw.create_profile({ scorer = 'fzf' })))
+  end)
+
+  it('position encoding', function()
+    -- 'é' is 2 bytes and 1 utf-16 unit, '😀' 4 bytes and 2 units
+    local line_text = 'é😀 = fo'
+    local edit = function(character)
+      return {
+        newText = 'foo',
+        range = { start = { line = 4, character = character }, ['end'] = { line = 4, character = character + 2 } },
+      }
+    end
+    for _, case in ipairs({ { 'utf-16', 6, 9 }, { 'utf-32', 5, 9 }, { 'utf-8', 9, 9 } }) do
+      paw.clear_completion_items()
+      local items = { { label = 'foo', kind = 6, textEdit = edit(case[2]) } }
+      paw.insert_items(items, 1, 3, 5, 11, {
+        word_start = 10,
+        word = 'fo',
+        is_incomplete = false,
+        line_text = line_text,
+        encoding = case[1],
+      })
+      local output = paw.get_completion_items(3, 5, 11, 10, { keyword = 'fo' })
+      assert(#output == 1)
+      assert(output[1].textEdit.range.start.character == case[3])
+    end
+
+    -- ascii lines are left as they are
+    paw.clear_completion_items()
+    local items = { { label = 'foo', kind = 6, textEdit = edit(4) } }
+    paw.insert_items(items, 1, 3, 5, 6, {
+      word_start = 5,
+      word = 'fo',
+      is_incomplete = false,
+      line_text = 'x = fo',
+      encoding = 'utf-16',
+    })
+    local output = paw.get_completion_items(3, 5, 6, 5, { keyword = 'fo' })
+    assert(output[1].textEdit.range.start.character == 4)
+    paw.clear_completion_items()
+  end)
+
+  it('parallel scoring', function()
+    local completion_items = {}
+    for i = 1, 20000 do
+      table.insert(completion_items, { label = generate_random_string(math.random(1, 30)), kind = 1 })
+    end
+    paw.insert_items(completion_items, 1, 2, 1, 11)
+
+    for _, kernel in ipairs({ 'dp', 'bit_parallel', 'simd' }) do
+      local option = { keyword = 'ab', kernel = kernel, max_results = 0 }
+      paw.set_worker_threads(1)
+      local expected = paw.get_completion_items(2, 1, 11, 1, option)
+      paw.set_worker_threads(4)
+      local output = paw.get_completion_items(2, 1, 11, 1, option)
+      assert(#output == #expected)
+      for i = 1, #output do
+        assert(output[i].label == expected[i].label)
+        assert(output[i].cost == expected[i].cost)
+      end
+    end
+    paw.set_worker_threads(0)
+  end)
+
+  it('rank_async', function()
+    local completion_items = {}
+    for i = 1, 5000 do
+      table.insert(completion_items, { label = generate_random_string(math.random(1, 30)), kind = 1 })
+    end
+    paw.insert_items(completion_items, 1, 2, 1, 12)
+    paw.insert_items(completion_items, 1, 3, 1, 12)
+
+    local option = { keyword = 'ab', max_results = 20 }
+    local expected = paw.get_completion_items(2, 1, 12, 1, option)
+
+    local function wait_result(id)
+      local items = nil
+      vim.wait(5000, function()
+        items = paw.take_result(id)
+        return items ~= nil
+      end, 1)
+      return items
+    end
+
+    local id = paw.rank_async(2, 1, 12, 1, option)
+    local output = wait_result(id)
+    assert(#output == #expected)
+    for i = 1, #output do
+      assert(output[i].label == expected[i].label)
+      assert(output[i].cost == expected[i].cost)
+    end
+    assert(paw.take_result(id) == nil)
+
+    -- a newer request for the buffer drops the older one
+    local old = paw.rank_async(3, 1, 12, 1, { keyword = 'a' })
+    local new = paw.rank_async(3, 1, 12, 1, option)
+    assert(#wait_result(new) == #expected)
+    assert(paw.take_result(old) == nil)
+
+    -- the copy the ranker scored goes with the cache
+    assert(paw.cache_stats().snapshot > 0)
+    paw.clear_completion_items()
+    assert(paw.cache_stats().snapshot == 0)
+  end)
+
+  it('incremental refinement', function()
+    local completion_items = {}
+    for i = 1, 2000 do
+      table.insert(completion_items, { label = generate_random_string(math.random(4, 24)), kind = 1 })
+    end
+    paw.insert_items(completion_items, 1, 4, 1, 10)
+
+    local bufnr = 4
+    for _, keyword in ipairs({ 'a', 'ab', 'abC', 'ab', 'x', 'xY', 'xYz' }) do
+      local option = {
+        keyword = keyword,
+        insert_cost = 1,
+        delete_cost = 1,
+        substitude_cost = 2,
+      }
+      local output = paw.get_completion_items(4, 1, 10, 1, option)
+      bufnr = bufnr + 1
+      paw.insert_items(completion_items, 1, bufnr, 1, 10)
+      local expected = paw.get_completion_items(bufnr, 1, 10, 1, option)
+      assert(#output == #expected)
+      for i = 1, #output do
+        assert(output[i].label == expected[i].label)
+        assert(output[i].cost == expected[i].cost)
+      end
+    end
+  end)
+
+  it('character mask prefilter', function()
+    -- '(' and '\\', '.' and '|', and both bytes of 'é' share a mask bit
+    local characters = { 'a', 'B', 'x', '1', '9', '_', '-', '.', '(', '\\', '|', 'é' }
+    local completion_items = {}
+    local seen = {}
+    for i = 1, 3000 do
+      local label = ''
+      for _ = 1, math.random(1, 12) do
+        label = label .. characters[math.random(1, #characters)]
+      end
+      if not seen[label:lower()] then
+        seen[label:lower()] = true
+        table.insert(completion_items, { label = label, kind = 1 })
+      end
+    end
+    paw.insert_items(completion_items, 1, 2, 1, 15)
+
+    local function is_subsequence(text, keyword)
+      local j = 1
+      for k = 1, #text do
+        if j <= #keyword and text:byte(k) == keyword:byte(j) then
+          j = j + 1
+        end
+      end
+      return j > #keyword
+    end
+
+    for _, keyword in ipairs({ '_', 'a-', '19', 'é', '.(', '(\\', '|.', '\\', 'x_1', 'b(é' }) do
+      local expected = {}
+      local count = 0
+      for _, item in ipairs(completion_items) do
+        if is_subsequence(item.label:lower(), keyword:lower()) then
+          expected[item.label] = true
+          count = count + 1
+        end
+      end
+      local output = paw.get_completion_items(2, 1, 15, 1, { keyword = keyword, insert_cost = 1, delete_cost = 1, substitude_cost = 2 })
+      assert(#output == count)
+      for _, item in ipairs(output) do
+        assert(expected[item.label])
+      end
+    end
+  end)
+
+  it('pair index', function()
+    local completion_items = {}
+    for i = 1, 3000 do
+      table.insert(completion_items, { label = generate_random_string(math.random(4, 24)), kind = 1 })
+    end
+    paw.insert_items(completion_items, 1, 21, 1, 10)
+
+    local option = {
+      insert_cost = 1,
+      delete_cost = 1,
+      substitude_cost = 2,
+    }
+    -- keywords that do not extend each other, so each one filters every item
+    for _, keyword in ipairs({ 'ab', 'x', 'q1', 'zzz', 'a_b', 'mno' }) do
+      option.keyword = keyword
+      option.index_threshold = 0
+      local expected = paw.get_completion_items(21, 1, 10, 1, option)
+      option.index_threshold = 1000
+      local output = paw.get_completion_items(21, 1, 10, 1, option)
+      assert(#output == #expected)
+      for i = 1, #output do
+        assert(output[i].label == expected[i].label)
+        assert(output[i].cost == expected[i].cost)
+      end
+    end
+  end)
+
+  it('max_results and get_completion_page', function()
+    local completion_items = {}
+    for i = 1, 2000 do
+      table.insert(completion_items, { label = generate_random_string(math.random(4, 24)), kind = 1 })
+    end
+    paw.insert_items(completion_items, 1, 20, 1, 10)
+
+    local option = {
+      keyword = 'a',
+      insert_cost = 1,
+      delete_cost = 1,
+      substitude_cost = 2,
+    }
+    local expected = paw.get_completion_items(20, 1, 10, 1, option)
+    option.max_results = 10
+    local output = paw.get_completion_items(20, 1, 10, 1, option)
+    assert(#output == math.min(10, #expected))
+
+    local offset = #output
+    while true do
+      local page = paw.get_completion_page(offset, 7)
+      if #page == 0 then
+        break
+      end
+      for _, item in ipairs(page) do
+        table.insert(output, item)
+      end
+      offset = offset + #page
+    end
+    assert(#output == #expected)
+    for i = 1, #output do
+      assert(output[i].cost == expected[i].cost)
+    end
+  end)
+
+  it('lazy completion items', function()
+    local completion_items = {}
+    for i = 1, 2000 do
+      table.insert(completion_items, { label = generate_random_string(math.random(4, 24)), kind = 1, detail = 'detail' })
+    end
+    paw.insert_items(completion_items, 1, 30, 1, 10)
+
+    local option = {
+      keyword = 'a',
+      insert_cost = 1,
+      delete_cost = 1,
+      substitude_cost = 2,
+    }
+    local expected = paw.get_completion_items(30, 1, 10, 1, option)
+    option.lazy = true
+    local output = paw.get_completion_items(30, 1, 10, 1, option)
+    assert(type(output) == 'userdata')
+    assert(#output == #expected)
+    for i = 1, #output do
+      assert(output[i].label == expected[i].label)
+      assert(output[i].kind == expected[i].kind)
+      assert(output[i].detail == 'detail')
+      assert(output[i].cost == expected[i].cost)
+      assert(output[i].textEdit.newText == expected[i].textEdit.newText)
+      assert(output[i].textEdit.range['end'].character == 10)
+    end
+    assert(output[#output + 1] == nil)
+
+    paw.clear_completion_items()
+    assert(output[1] == nil)
+  end)
+
+  it('benchmark lazy completion items', function()
+    local completion_items = {}
+    for i = 1, 20000 do
+      table.insert(completion_items, { label = generate_random_string(math.random(4, 24)), kind = 1 })
+    end
+    paw.insert_items(completion_items, 1, 31, 1, 10)
+
+    for _, lazy in ipairs({ false, true }) do
+      local option = {
+        keyword = 'a',
+        insert_cost = 1,
+        delete_cost = 1,
+        substitude_cost = 2,
+        lazy = lazy,
+      }
+      local start = os.clock()
+      local output = paw.get_completion_items(31, 1, 10, 1, option)
+      for i = 1, math.min(10, #output) do
+        local _ = output[i].label
+      end
+      local fin = os.clock() - start
+      print('lazy ' .. tostring(lazy) .. ':', fin)
+    end
+  end)
+
+  it('benchmark edit distance kernels', function()
+    local completion_items = {}
+    for i = 1, 20000 do
+      table.insert(completion_items, { label = generate_random_string(math.random(4, 32)), kind = 1 })
+    end
+    paw.insert_items(completion_items, 1, 3, 1, 10)
+
+    for _, kernel in ipairs({ 'dp', 'bit_parallel', 'simd' }) do
+      local option = {
+        keyword = 'abcdefghijkl',
+        insert_cost = 1,
+        delete_cost = 1,
+        substitude_cost = 2,
+        kernel = kernel,
+      }
+      local start = os.clock()
+      paw.get_completion_items(3, 1, 10, 1, option)
+      local fin = os.clock() - start
+      print(kernel .. ' kernel:', fin)
+    end
+  end)
+
+  it('benchmark parallel scoring', function()
+    local completion_items = {}
+    for i = 1, 20000 do
+      table.insert(completion_items, { label = generate_random_string(math.random(4, 32)), kind = 1 })
+    end
+    paw.insert_items(completion_items, 1, 3, 1, 11)
+
+    -- os.clock() adds up the cpu time of every thread, so time the wall clock
+    for _, threads in ipairs({ 1, 0 }) do
+      paw.set_worker_threads(threads)
+      local option = { keyword = '', kernel = 'dp', max_results = 100 }
+      local start = vim.uv.hrtime()
+      paw.get_completion_items(3, 1, 11, 1, option)
+      local fin = (vim.uv.hrtime() - start) / 1e9
+      print((threads == 0 and 'all' or threads) .. ' threads:', fin)
+    end
+  end)
+
+  it('benchmark pair index', function()
+    local option = {
+      insert_cost = 1,
+      delete_cost = 1,
+      substitude_cost = 2,
+      max_results = 100,
+    }
+    local keywords = { 'get', 'set', 'to', 'vec', 'str', 'map', 'io', 'fmt' }
+    for _, n in ipairs({ 1000, 5000, 10000, 20000, 50000, 100000 }) do
+      local completion_items = {}
+      for i = 1, n do
+        table.insert(completion_items, { label = generate_random_string(math.random(4, 24)), kind = 1 })
+      end
+      paw.insert_items(completion_items, 1, 22, 1, n)
+
+      local times = {}
+      for _, threshold in ipairs({ 0, 1 }) do
+        option.index_threshold = threshold
+        -- the first call builds the index
+        option.keyword = 'x'
+        paw.get_completion_items(22, 1, n, 1, option)
+        local start = os.clock()
+        for i = 1, 100 do
+          option.keyword = keywords[i % #keywords + 1]
+          paw.get_completion_items(22, 1, n, 1, option)
+        end
+        table.insert(times, os.clock() - start)
+      end
+      print(string.format('%6d items, 100 keywords: scan %.4f index %.4f', n, times[1], times[2]))
+    end
+    paw.clear_completion_items()
+  end)
+
+  it('benchmark insert_items', function()
+    local details = { 'std::string', 'int', 'void', 'module foo' }
+    local completion_items = {}
+    for i = 1, 20000 do
+      local label = generate_random_string(math.random(6, 26))
+      table.insert(completion_items, {
+        label = label,
+        kind = 3,
+        detail = details[math.random(1, #details)],
+        sortText = label,
+        insertText = label .. '()',
+      })
+    end
+
+    local start = os.clock()
+    for bufnr = 1, 5 do
+      paw.insert_items(completion_items, 1, bufnr, 1, 1)
+    end
+    local fin = os.clock() - start
+    print('insert_items:', fin)
+
+    start = os.clock()
+    paw.clear_completion_items()
+    fin = os.clock() - start
+    print('clear_completion_items:', fin)
+  end)
+
+  it('cache budget', function()
+    paw.clear_completion_items()
+    local budget = 2 * 1024 * 1024
+    paw.set_cache_budget(budget)
+    local completion_items = {}
+    for i = 1, 2000 do
+      table.insert(completion_items, {
+        label = generate_random_string(math.random(4, 24)),
+        detail = generate_random_string(math.random(20, 60)),
+        kind = 1,
+      })
+    end
+    local before = paw.cache_stats()
+    for bufnr = 100, 119 do
+      paw.insert_items(completion_items, 1, bufnr, 1, 1)
+    end
+    paw.get_completion_items(119, 1, 1, 1, { keyword = 'a' })
+    paw.get_completion_items(1000, 1, 1, 1, { keyword = 'a' })
+
+    local stats = paw.cache_stats()
+    assert(stats.bytes <= budget)
+    assert(stats.budget == budget)
+    assert(stats.evictions > before.evictions)
+    assert(stats.hits == before.hits + 1)
+    assert(stats.misses == before.misses + 1)
+    assert(paw.has_cache(119, 1, 1))
+    -- the interned details and the rank_async copy count toward the budget
+    assert(stats.interned > 0)
+    assert(stats.bytes >= stats.interned + stats.snapshot)
+
+    local id = paw.rank_async(119, 1, 1, 1, { keyword = 'b' })
+    vim.wait(5000, function()
+      return paw.take_result(id) ~= nil
+    end, 1)
+    stats = paw.cache_stats()
+    assert(stats.snapshot > 0)
+    assert(stats.bytes >= stats.interned + stats.snapshot)
+    assert(stats.bytes <= budget)
+    assert(paw.has_cache(119, 1, 1))
+
+    paw.set_cache_budget(256 * 1024 * 1024)
+    paw.clear_completion_items()
+  end)
+
+  it('can_refilter', function()
+    paw.clear_completion_items()
+    local completion_items = { { label = 'foobar' }, { label = 'food' }, { label = 'bar' } }
+    paw.insert_items(completion_items, 1, 1, 3, 6, { word_start = 5, word = 'fo', is_incomplete = false })
+    paw.insert_items(completion_items, 2, 1, 3, 6, { word_start = 5, word = 'fo', is_incomplete = true })
+
+    assert(paw.can_refilter(1, 1, 3, 5, 'foo') == 6)
+    assert(paw.can_refilter(1, 1, 3, 5, 'f') == nil)
+    assert(paw.can_refilter(1, 1, 3, 4, 'foo') == nil)
+    assert(paw.can_refilter(2, 1, 3, 5, 'foo') == nil)
+
+    -- refiltered at the cached col, the text edit ends at the cursor
+    local items = paw.get_completion_items(1, 3, 6, 5, { keyword = 'food' }, 8)
+    assert(items[1].label == 'food')
+    assert(items[1].textEdit.range.start.character == 4)
+    assert(items[1].textEdit.range['end'].character == 8)
+
+    paw.clear_completion_items()
+    assert(paw.can_refilter(1, 1, 3, 5, 'foo') == nil)
+  end)
+
+  it('chunked insert_items', function()
+    paw.clear_completion_items()
+    local completion_items = {}
+    for i = 1, 250 do
+      table.insert(completion_items, { label = 'item' .. i })
+    end
+    local response = { word_start = 1, word = '', is_incomplete = false }
+
+    local offset = paw.insert_items(completion_items, 1, 41, 1, 1, response, { max_items = 100 })
+    assert(offset == 101)
+    -- the first chunk ranks right away but is not refiltered yet
+    assert(#paw.get_completion_items(41, 1, 1, 1, { keyword = 'item', max_results = 0 }) == 100)
+    assert(paw.can_refilter(1, 41, 1, 1, 'it') == nil)
+
+    offset = paw.insert_items(completion_items, 1, 41, 1, 1, response, { offset = offset, max_items = 100 })
+    assert(offset == 201)
+    offset = paw.insert_items(completion_items, 1, 41, 1, 1, response, { offset = offset, max_items = 100 })
+    assert(offset == nil)
+    assert(#paw.get_completion_items(41, 1, 1, 1, { keyword = 'item', max_results = 0 }) == 250)
+    assert(paw.can_refilter(1, 41, 1, 1, 'it') == 1)
+
+    -- without limits a chunk takes the rest
+    assert(paw.insert_items(completion_items, 1, 42, 1, 1, nil, { offset = 51 }) == nil)
+    assert(#paw.get_completion_items(42, 1, 1, 1, { keyword = 'item', max_results = 0 }) == 200)
+    paw.clear_completion_items()
+  end)
+
+  it('insert_items with a bad item', function()
+    local range = { start = { line = 'x', character = 0 }, ['end'] = { line = 0, character = 1 } }
+    local items = { { label = 'fine' }, { label = 'bad', textEdit = { newText = 'bad', range = range } } }
+    assert(not pcall(paw.insert_items, items, 1, 43, 1, 1))
+    -- nothing of the call went in, and the next calls are not locked out
+    assert(not paw.has_cache(43, 1, 1))
+    paw.insert_items({ { label = 'fine' } }, 1, 43, 1, 1)
+    assert(#paw.get_completion_items(43, 1, 1, 1, { keyword = 'fine' }) == 1)
+    paw.clear_completion_items()
+  end)
+
+  it('benchmark chunked insert_items', function()
+    local completion_items = {}
+    for i = 1, 20000 do
+      table.insert(completion_items, { label = generate_random_string(math.random(4, 24)), kind = 1 })
+    end
+
+    local slowest = 0
+    local chunks = 0
+    local offset = 1
+    while offset do
+      local start = os.clock()
+      offset = paw.insert_items(completion_items, 1, 43, 1, 1, nil, { offset = offset, max_us = 2000 })
+      slowest = math.max(slowest, os.clock() - start)
+      chunks = chunks + 1
+    end
+    print('20000 items in', chunks, 'chunks, slowest chunk:', slowest)
+    paw.clear_completion_items()
+  end)
+
+  it('merge duplicates across clients', function()
+    paw.clear_completion_items()
+    local before = paw.cache_stats()
+    local first = {
+      { label = 'foo', kind = 3, detail = 'first' },
+      { label = 'foo', kind = 3, detail = 'overload' },
+      { label = 'bar', kind = 6 },
+    }
+    local second = {
+      { label = 'Foo', kind = 3, detail = 'second' },
+      { label = 'bar', kind = 3 },
+      { label = 'baz', kind = 6 },
+    }
+
+    -- overloads from one client are kept
+    local _, merged = paw.insert_items(first, 1, 50, 1, 1)
+    assert(merged == 0)
+    _, merged = paw.insert_items(second, 2, 50, 1, 1)
+    assert(merged == 1)
+    local items = paw.get_completion_items(50, 1, 1, 1, { keyword = '', insert_cost = 1, delete_cost = 1, substitude_cost = 2 })
+    assert(#items == 5)
+    assert(paw.cache_stats().duplicates == before.duplicates + 1)
+
+    -- the client with the higher priority keeps its item
+    paw.set_client_priority(2, 10)
+    paw.insert_items(first, 1, 51, 1, 1)
+    paw.insert_items(second, 2, 51, 1, 1)
+    items = paw.get_completion_items(51, 1, 1, 1, { keyword = 'foo', insert_cost = 1, delete_cost = 1, substitude_cost = 2 })
+    local details = {}
+    for _, item in ipairs(items) do
+      details[item.detail] = true
+    end
+    assert(details.second and details.overload and not details.first)
+    paw.set_client_priority(2, 0)
+    paw.clear_completion_items()
+  end)
+
+  it('buffer words', function()
+    paw.clear_completion_items()
+    paw.set_buffer_lines(60, 0, -1, { 'local foo_bar = 1', 'local food = foo_bar + 2', 'fo' })
+    -- 'fo' is the word being typed, 'local' and numbers do not match
+    assert(paw.insert_buffer_words(60, 3, 2, 'fo') == 2)
+    local option = { keyword = 'fo', insert_cost = 1, delete_cost = 1, substitude_cost = 2 }
+    local items = paw.get_completion_items(60, 3, 2, 1, option)
+    assert(#items == 2)
+    assert(items[1].kind == 1)
+
+    -- the second line goes away with its only 'food', 'foo_bar' stays
+    paw.set_buffer_lines(60, 1, 2, {})
+    paw.clear_completion_items()
+    assert(paw.insert_buffer_words(60, 2, 2, 'fo') == 1)
+    items = paw.get_completion_items(60, 2, 2, 1, option)
+    assert(items[1].label == 'foo_bar')
+
+    -- an edited line only replaces its own words
+    paw.set_buffer_lines(60, 0, 1, { 'local fox' })
+    paw.clear_completion_items()
+    assert(paw.insert_buffer_words(60, 2, 2, 'fo') == 1)
+    items = paw.get_completion_items(60, 2, 2, 1, option)
+    assert(items[1].label == 'fox')
+
+    paw.clear_buffer_words(60)
+    paw.clear_completion_items()
+    assert(paw.insert_buffer_words(60, 2, 2, 'fo') == 0)
+  end)
+
+  it('benchmark buffer words', function()
+    local lines = {}
+    for i = 1, 50000 do
+      table.insert(lines, string.format('  local value_%d = require("mod_%d").call(arg, other_thing)', i % 5000, i % 300))
+    end
+    local start = os.clock()
+    paw.set_buffer_lines(61, 0, -1, lines)
+    print('tokenize 50000 lines:', os.clock() - start)
+
+    start = os.clock()
+    for i = 1, 1000 do
+      paw.set_buffer_lines(61, i * 37, i * 37 + 1, { '  local changed_name = 1' })
+    end
+    print('1000 line edits:', os.clock() - start)
+
+    start = os.clock()
+    paw.insert_buffer_words(61, 1, 1, 'val')
+    print('insert buffer words:', os.clock() - start)
+    paw.clear_buffer_words(61)
+    paw.clear_completion_items()
+  end)
+
+  it('frecency', function()
+    local path = vim.fn.tempname()
+    assert(paw.open_frecency(path, 24))
+    paw.clear_completion_items()
+    paw.insert_items({ { label = 'format_string' }, { label = 'forest' } }, 1, 70, 1, 1)
+    local option = {
+      keyword = 'for',
+      insert_cost = 1,
+      delete_cost = 1,
+      substitude_cost = 2,
+      filetype = 'lua',
+      frecency_boost = 10,
+    }
+    local items = paw.get_completion_items(70, 1, 1, 1, option)
+    assert(items[1].label == 'forest')
+
+    for _ = 1, 5 do
+      paw.record_selection('lua', 'format_string')
+    end
+    -- accepts in another filetype do not count
+    option.filetype = 'python'
+    items = paw.get_completion_items(70, 1, 1, 1, option)
+    assert(items[1].label == 'forest')
+
+    option.filetype = 'lua'
+    items = paw.get_completion_items(70, 1, 1, 1, option)
+    assert(items[1].label == 'format_string')
+
+    -- kept on disk
+    assert(paw.open_frecency(path, 24))
+    items = paw.get_completion_items(70, 1, 1, 1, option)
+    assert(items[1].label == 'format_string')
+    paw.clear_completion_items()
+    os.remove(path)
+  end)
+
+  it('response cache', function()
+    local path = vim.fn.tempname()
+    paw.clear_completion_items()
+    paw.insert_items({
+      { label = 'format', kind = 3, detail = 'fn format()', insertTextFormat = 2, insertText = 'format($1)' },
+      { label = 'forest', kind = 6 },
+    }, 1, 80, 1, 1)
+    assert(paw.save_response_cache(path, { [80] = '/project/main.rs' }))
+    paw.clear_completion_items()
+
+    -- next session, bufnr 81 now holds the file
+    assert(paw.load_response_cache(path))
+    assert(paw.insert_saved_items(81, '/project/other.rs', 1, 3, 'fo') == 0)
+    assert(paw.insert_saved_items(81, '/project/main.rs', 1, 3, 'form') == 1)
+    local option = { keyword = 'form', insert_cost = 1, delete_cost = 1, substitude_cost = 2 }
+    local items = paw.get_completion_items(81, 1, 3, 1, option)
+    assert(#items == 1)
+    assert(items[1].label == 'format')
+    assert(items[1].detail == 'fn format()')
+    assert(items[1].insertTextFormat == 2)
+
+    -- the live response replaces them, and the buffer gets no more
+    paw.insert_items({ { label = 'formula' } }, 1, 81, 1, 3)
+    items = paw.get_completion_items(81, 1, 3, 1, option)
+    assert(#items == 1)
+    assert(items[1].label == 'formula')
+    assert(paw.insert_saved_items(81, '/project/main.rs', 2, 3, 'form') == 0)
+
+    paw.clear_completion_items()
+    os.remove(path)
+  end)
+
+  it('stats', function()
+    paw.clear_completion_items()
+    paw.reset_stats()
+    paw.insert_items({ { label = 'foo' }, { label = 'foobar' }, { label = 'bar' } }, 1, 90, 1, 1)
+    local option = { keyword = 'foo', insert_cost = 1, delete_cost = 1, substitude_cost = 2 }
+    paw.get_completion_items(90, 1, 1, 1, option)
+    paw.get_completion_items(90, 1, 1, 1, option)
+
+    local stats = paw.stats()
+    assert(stats.parse.count == 1)
+    assert(stats.inserted.max == 3)
+    assert(stats.score.count == 2)
+    assert(stats.sort.count == 2)
+    assert(stats.marshal.count == 2)
+    assert(stats.ranked.p50 == 3)
+    assert(stats.matched.p99 == 2)
+    assert(stats.score.p50 <= stats.score.p99 and stats.score.p99 <= stats.score.max)
+
+    paw.reset_stats()
+    assert(paw.stats().score.count == 0)
+    paw.clear_completion_items()
+  end)
+
+  it('trace', function()
+    local path = vim.fn.tempname()
+    paw.clear_completion_items()
+    paw.set_trace(true, 16)
+    paw.insert_items({ { label = 'foo' }, { label = 'bar' } }, 3, 91, 1, 1)
+    paw.get_completion_items(91, 1, 1, 1, { keyword = 'f', insert_cost = 1, delete_cost = 1, substitude_cost = 2 })
+    local start = paw.trace_now()
+    paw.trace_span('format_completion_item', start, 91, nil, 1)
+    paw.set_trace(false)
+    -- nothing is kept while disabled
+    paw.insert_items({ { label = 'baz' } }, 3, 91, 1, 1)
+    assert(paw.trace_dump(path))
+
+    local trace = vim.json.decode(table.concat(vim.fn.readfile(path), '\n'))
+    local names = {}
+    for _, event in ipairs(trace.traceEvents) do
+      assert(event.ph == 'X' and event.dur >= 0)
+      names[event.name] = event
+    end
+    assert(names.insert_items.args.client_id == 3)
+    assert(names.insert_items.args.items == 2)
+    assert(names.score and names.sort and names.marshal)
+    assert(names.get_completion_items.args.bufnr == 91)
+    assert(names.format_completion_item.args.items == 1)
+    assert(#trace.traceEvents == 7)
+
+    paw.clear_completion_items()
+    os.remove(path)
+  end)
+
+  it('record session', function()
+    local path = vim.fn.tempname()
+    local items = {
+      { label = 'getSecretValue', detail = 'int getSecretValue()', sortText = 'zsecret' },
+      { label = 'setSecretValue', sortText = 'asecret' },
+    }
+    local option = { keyword = 'getSec', insert_cost = 1, delete_cost = 1, substitude_cost = 2 }
+    for _, mode in ipairs({ 'none', 'scramble' }) do
+      assert(paw.start_recording(path, mode ~= 'none' and mode or nil))
+      paw.clear_completion_items()
+      paw.insert_items(items, 1, 92, 1, 7)
+      paw.get_completion_items(92, 1, 7, 1, option)
+      assert(paw.stop_recording())
+
+      local file = io.open(path, 'rb')
+      local data = file:read('*a')
+      file:close()
+      assert(data:sub(1, 4) == 'PAWS')
+      assert((data:find('getSecretValue', 1, true) ~= nil) == (mode == 'none'))
+      assert((data:find('int getSecretValue()', 1, true) ~= nil) == (mode == 'none'))
+      assert((data:find('zsecret', 1, true) ~= nil) == (mode == 'none'))
+    end
+    assert(not pcall(paw.start_recording, path, 'rot13'))
+
+    paw.clear_completion_items()
+    os.remove(path)
+  end)
+
+  it('benchmark cache lookups', function()
+    local completion_items = {}
+    for i = 1, 5000 do
+      table.insert(completion_items, { label = generate_random_string(math.random(4, 24)), kind = 1 })
+    end
+    paw.insert_items(completion_items, 1, 40, 1, 1)
+
+    -- nothing matches, so the time goes to finding the cached list
+    local option = { keyword = '~~~~' }
+    local start = os.clock()
+    for i = 1, 1000 do
+      paw.get_completion_items(40, 1, 1, 1, option)
+    end
+    local fin = os.clock() - start
+    print('1000 cache lookups:', fin)
+  end)
+
   it('find_last_word_index', function()
     assert(paw.find_last_word_index('hello world') == 6)
     assert(paw.find_last_word_index('hello world ') == nil)